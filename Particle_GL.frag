@@ -0,0 +1,13 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec4 fragColor;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // square points: no texture, no discard
+    color = fragColor;
+}
@@ -0,0 +1,26 @@
+#version 330 core
+
+// input data : one particle, each field from its own array
+layout (location = 0) in float particleX;
+layout (location = 1) in float particleY;
+layout (location = 2) in float particleLife;
+layout (location = 3) in uint particleColor;
+
+uniform mat4 MVP;
+// point size in framebuffer pixels
+uniform float PointSize;
+// ticks over which debris fades out
+uniform float FadeTicks;
+
+// output data : used by fragment shader
+out vec4 fragColor;
+
+// brick colours: black, red, green
+const vec3 palette[3] = vec3[3](vec3(0.2, 0.2, 0.2), vec3(0.9, 0.1, 0.1), vec3(0.1, 0.7, 0.1));
+
+void main ()
+{
+    fragColor = vec4(palette[min(particleColor, 2u)], clamp(particleLife / FadeTicks, 0.0, 1.0));
+    gl_PointSize = PointSize;
+    gl_Position = MVP * vec4(particleX, particleY, 0, 1);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+
+// Interpolated values from the vertex shaders
+in vec2 uv;
+in vec3 fragColor;
+
+// glyph coverage in the red channel
+uniform sampler2D Atlas;
+
+// output data
+out vec4 color;
+
+void main()
+{
+    // the glyph's pixels in the text colour, the rest of the quad see-through
+    color = vec4(fragColor, texture(Atlas, uv).r);
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+// input data : one corner of a glyph quad, in framebuffer pixels from the top left
+layout (location = 0) in vec2 vertexPosition;
+layout (location = 1) in vec2 vertexUV;
+layout (location = 2) in vec3 vertexColor;
+
+// framebuffer size in pixels
+uniform vec2 Screen;
+
+// output data : used by fragment shader
+out vec2 uv;
+out vec3 fragColor;
+
+void main ()
+{
+    uv = vertexUV;
+    fragColor = vertexColor;
+
+    // pixels to clip space, y down
+    gl_Position = vec4(vertexPosition.x*2/Screen.x - 1, 1 - vertexPosition.y*2/Screen.y, 0, 1);
+}
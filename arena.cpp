@@ -0,0 +1,158 @@
+#include <cstdlib>
+#include <new>
+#include <atomic>
+
+#include "arena.h"
+
+using namespace std;
+
+/* Heap block holding one oversized request or the overflow of a full arena */
+struct arena_spill {
+  arena_spill* next;
+  size_t pad;  // keeps the data after it ARENA_ALIGN aligned
+};
+
+frame_arena frame;
+
+static atomic<uint64_t> heap_allocs(0), heap_frees(0), heap_bytes(0), heap_live(0);
+
+/* Every block carries its size in front, so frees can be taken off the live
+ * byte count; 16 bytes keeps the block as aligned as malloc made it */
+#define HEAP_HEADER 16
+
+void* heapAlloc (size_t bytes)
+{
+  char* p = (char*)malloc(bytes + HEAP_HEADER);
+  if (p == NULL)
+    return NULL;
+  *(size_t*)p = bytes;
+  heap_allocs.fetch_add(1, memory_order_relaxed);
+  heap_bytes.fetch_add(bytes, memory_order_relaxed);
+  heap_live.fetch_add(bytes, memory_order_relaxed);
+  return p + HEAP_HEADER;
+}
+
+void heapFree (void* p)
+{
+  if (p == NULL)
+    return;
+  char* block = (char*)p - HEAP_HEADER;
+  heap_frees.fetch_add(1, memory_order_relaxed);
+  heap_live.fetch_sub(*(size_t*)block, memory_order_relaxed);
+  free(block);
+}
+
+void* heapRealloc (void* p, size_t bytes)
+{
+  if (p == NULL)
+    return heapAlloc(bytes);
+  char* block = (char*)p - HEAP_HEADER;
+  size_t old = *(size_t*)block;
+  char* q = (char*)realloc(block, bytes + HEAP_HEADER);
+  if (q == NULL)
+    return NULL;
+  *(size_t*)q = bytes;
+  // the old block goes and a new one comes, as far as the counts go
+  heap_allocs.fetch_add(1, memory_order_relaxed);
+  heap_frees.fetch_add(1, memory_order_relaxed);
+  heap_bytes.fetch_add(bytes, memory_order_relaxed);
+  heap_live.fetch_add(bytes - old, memory_order_relaxed);
+  return q + HEAP_HEADER;
+}
+
+heap_stats heapStats ()
+{
+  heap_stats s;
+  s.allocs = heap_allocs.load(memory_order_relaxed);
+  s.frees = heap_frees.load(memory_order_relaxed);
+  s.bytes = heap_bytes.load(memory_order_relaxed);
+  s.live = heap_live.load(memory_order_relaxed);
+  return s;
+}
+
+void* operator new (size_t bytes)
+{
+  void* p = heapAlloc(bytes);
+  if (p == NULL)
+    throw bad_alloc();
+  return p;
+}
+
+void* operator new (size_t bytes, const nothrow_t&) noexcept
+{
+  return heapAlloc(bytes);
+}
+
+void operator delete (void* p) noexcept
+{
+  heapFree(p);
+}
+
+void operator delete (void* p, const nothrow_t&) noexcept
+{
+  heapFree(p);
+}
+
+void arenaInit (frame_arena* a, size_t size)
+{
+  a->size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  a->base = (char*)heapAlloc(a->size);
+  a->used = 0;
+  a->peak = 0;
+  a->spill = NULL;
+  a->spilled = 0;
+}
+
+static void freeSpills (frame_arena* a)
+{
+  while (a->spill != NULL)
+  {
+    arena_spill* next = a->spill->next;
+    heapFree(a->spill);
+    a->spill = next;
+  }
+  a->spilled = 0;
+}
+
+void arenaFree (frame_arena* a)
+{
+  freeSpills(a);
+  heapFree(a->base);
+  a->base = NULL;
+  a->size = a->used = 0;
+}
+
+void* arenaAlloc (frame_arena* a, size_t bytes)
+{
+  bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (a->used + bytes <= a->size)
+  {
+    void* p = a->base + a->used;
+    a->used += bytes;
+    return p;
+  }
+
+  // full: this frame's extra goes on the heap, and the next reset grows the block
+  arena_spill* s = (arena_spill*)heapAlloc(sizeof(arena_spill) + bytes);
+  if (s == NULL)
+    throw bad_alloc();
+  s->next = a->spill;
+  a->spill = s;
+  a->spilled += bytes;
+  return s + 1;
+}
+
+void arenaReset (frame_arena* a)
+{
+  size_t total = a->used + a->spilled;
+  if (total > a->peak)
+    a->peak = total;
+  if (a->spill != NULL)
+  {
+    freeSpills(a);
+    heapFree(a->base);
+    a->size = a->peak + a->peak / 2;
+    a->base = (char*)heapAlloc(a->size);
+  }
+  a->used = 0;
+}
@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bump allocator for data that only lives until the end of the frame.
+ *
+ * Allocating is a pointer increment and nothing is freed one by one: the
+ * whole arena is reset once per frame. If a frame needs more than the block
+ * holds, the extra comes from the heap and the block is regrown to the
+ * frame's peak at the next reset, so after the first few frames the arena
+ * never touches the heap again. Not thread safe; one arena per thread. */
+
+#define ARENA_ALIGN 16
+
+struct arena_spill;
+
+struct frame_arena {
+  char* base;
+  size_t size;
+  size_t used;
+  size_t peak;          // most bytes handed out in one frame
+  arena_spill* spill;   // heap blocks for this frame's overflow
+  size_t spilled;
+};
+
+void arenaInit (frame_arena* a, size_t size);
+void arenaFree (frame_arena* a);
+void* arenaAlloc (frame_arena* a, size_t bytes);
+void arenaReset (frame_arena* a);
+
+template <class T> T* arenaArray (frame_arena* a, size_t n)
+{
+  return (T*)arenaAlloc(a, n * sizeof(T));
+}
+
+/* The main loop's arena, reset at the end of every frame */
+extern frame_arena frame;
+
+/* Every operator new and delete in the program, counted so a frame (or any
+ * stretch of code) can check it stayed off the heap, and a long session
+ * that its memory stays flat. allocs - frees is the live block count */
+struct heap_stats {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t bytes;  // ever allocated
+  uint64_t live;   // bytes allocated and not freed yet
+};
+
+heap_stats heapStats ();
+
+/* malloc, realloc and free for buffers that are not new'ed, counted in
+ * heapStats() like the rest. heapRealloc and heapFree only take what these
+ * returned; NULL on failure, leaving the old block as it was */
+void* heapAlloc (size_t bytes);
+void* heapRealloc (void* p, size_t bytes);
+void heapFree (void* p);
+
+#endif
@@ -0,0 +1,289 @@
+#include <cmath>
+#include <cstdlib>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "arena.h"
+#include "autopilot.h"
+#include "game.h"
+#include "trace.h"
+
+using namespace std;
+
+#define MAX_PLANS 32
+#define FIELD 40          // the playfield is -40..40 both ways
+#define CANNON_RANGE 30   // how far the cannon may slide from its start
+#define MAX_AIM 1.2f
+
+autopilot_plan autopilot_goal;
+float autopilot_score = 0;
+
+static int lookahead = AUTOPILOT_LOOKAHEAD;
+
+/* The tick being planned: the state every rollout starts from, the pattern
+ * playhead to copy, and one candidate and its score per slot */
+static game_state* root = NULL;
+static unsigned int root_capacity = 0;
+static spawn_pattern* root_pattern = NULL;
+static autopilot_plan plans[MAX_PLANS];
+static float scores[MAX_PLANS];
+static int num_plans = 0;
+
+/* Fork-join pool. A round is published by bumping generation; workers claim plans
+ * from next_plan until they run out, and the last one to finish wakes the caller */
+static vector<thread> workers;
+static mutex pool_lock;
+static condition_variable pool_wake, pool_done;
+static unsigned int generation = 0;
+static int busy = 0;
+static bool stopping = false;
+static atomic<int> next_plan;
+
+static float clampf (float v, float lo, float hi)
+{
+  return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/* One tick of input towards p, no faster than the keys move things */
+static void steer (const autopilot_plan& p)
+{
+  float a = gun[0].rotate;
+  if (fabs(p.angle - a) > 1e-4f)
+    aimCannon(a + clampf(p.angle - a, -0.01f, 0.01f));
+
+  float d = clampf(p.cannon - gun[0].translate, -0.5f, 0.5f);
+  for (int j=0;j<2;j++)
+  {
+    gun[j].translate += d;
+    gun[j].y += d;
+  }
+
+  for (int j=0;j<2;j++)
+  {
+    d = clampf(p.basket[j] - bucket[j].translate, -0.5f, 0.5f);
+    bucket[j].translate += d;
+    bucket[j].x1 += d;
+    bucket[j].x2 += d;
+  }
+}
+
+/* x of the n lowest live bricks of colour c above the catch line, lowest first */
+static int lowest (int c, float* x, int n)
+{
+  float y[4];
+  int found = 0;
+  for (int i=0;i<num_boxes;i++)
+  {
+    if (!boxes[i].alive || boxes[i].c != c || boxes[i].y2 <= -36)
+      continue;
+    if (found == n && boxes[i].y1 >= y[n-1])
+      continue;
+    // insertion into the short sorted list
+    int k = found < n ? found++ : n-1;
+    for (; k > 0 && y[k-1] > boxes[i].y1; k--)
+    {
+      y[k] = y[k-1];
+      x[k] = x[k-1];
+    }
+    y[k] = boxes[i].y1;
+    x[k] = (boxes[i].x1 + boxes[i].x2) / 2;
+  }
+  return found;
+}
+
+/* Basket translate that centres basket j on x, kept on the field */
+static float basketAt (int j, float x)
+{
+  float left = bucket[j].x1 - bucket[j].translate, right = bucket[j].x2 - bucket[j].translate;
+  return clampf(x - (left + right) / 2, -FIELD - left, FIELD - right);
+}
+
+static void addPlan (autopilot_plan p)
+{
+  p.angle = clampf(p.angle, -MAX_AIM, MAX_AIM);
+  p.cannon = clampf(p.cannon, -CANNON_RANGE, CANNON_RANGE);
+  plans[num_plans++] = p;
+}
+
+/* The plan being followed, then changes to one part of it at a time:
+ * other aims and heights for the cannon, and for each basket the next
+ * bricks of its colour or a dodge to either side */
+static void candidates ()
+{
+  const autopilot_plan& g = autopilot_goal;
+  num_plans = 0;
+  addPlan(g);
+
+  static const float aims[] = { -0.3f, -0.1f, 0.1f, 0.3f };
+  static const float heights[] = { -8, -3, 3, 8 };
+  for (int k=0;k<4;k++)
+  {
+    autopilot_plan p = g;
+    p.angle += aims[k];
+    addPlan(p);
+    p = g;
+    p.cannon += heights[k];
+    addPlan(p);
+    p.angle += aims[3-k];
+    addPlan(p);
+  }
+
+  for (int j=0;j<2;j++)
+  {
+    float x[3];
+    int n = lowest(bucket[j].c, x, 3);
+    for (int k=0;k<n;k++)
+    {
+      autopilot_plan p = g;
+      p.basket[j] = basketAt(j, x[k]);
+      addPlan(p);
+    }
+    for (int side=-1;side<=1;side+=2)
+    {
+      autopilot_plan p = g;
+      p.basket[j] = basketAt(j, (bucket[j].x1 + bucket[j].x2) / 2 + side*6);
+      addPlan(p);
+    }
+  }
+}
+
+/* Plays plan k from the root state on this thread's copy of the game */
+static float rollout (int k)
+{
+  static thread_local spawn_pattern playhead;
+  if (root_pattern)
+  {
+    playhead = *root_pattern;
+    usePattern(&playhead);
+  }
+  else
+    usePattern(NULL);
+  loadState(root);
+
+  int start = points;
+  int t;
+  for (t=0; t<lookahead && !gameover; t++)
+  {
+    steer(plans[k]);
+    pullTrigger();
+    stepGame();
+  }
+  if (gameover)
+    return -100000 + t;
+
+  // nothing may be caught within the horizon: lean towards the next bricks
+  float score = points - start, x;
+  for (int j=0;j<2;j++)
+    if (lowest(bucket[j].c, &x, 1))
+      score -= 0.01f * fabs(x - (bucket[j].x1 + bucket[j].x2) / 2);
+  return score;
+}
+
+static void work ()
+{
+  int k;
+  while ((k = next_plan.fetch_add(1)) < num_plans)
+    scores[k] = rollout(k);
+}
+
+static void worker ()
+{
+  game_messages = false;
+  trace_mute(true);
+  unsigned int seen = 0;
+  while (true)
+  {
+    {
+      unique_lock<mutex> guard(pool_lock);
+      pool_wake.wait(guard, [&] { return stopping || generation != seen; });
+      if (stopping)
+        return;
+      seen = generation;
+    }
+    work();
+    lock_guard<mutex> guard(pool_lock);
+    if (--busy == 0)
+      pool_done.notify_one();
+  }
+}
+
+void autopilotStart (int threads, int ticks)
+{
+  if (threads <= 0)
+    threads = thread::hardware_concurrency();
+  if (threads <= 0)
+    threads = 1;
+  lookahead = ticks;
+
+  autopilot_goal.angle = gun[0].rotate;
+  autopilot_goal.cannon = gun[0].translate;
+  for (int j=0;j<2;j++)
+    autopilot_goal.basket[j] = bucket[j].translate;
+
+  stopping = false;
+  for (int i=0;i<threads;i++)
+    workers.push_back(thread(worker));
+}
+
+void autopilotStop ()
+{
+  {
+    lock_guard<mutex> guard(pool_lock);
+    stopping = true;
+  }
+  pool_wake.notify_all();
+  for (size_t i=0;i<workers.size();i++)
+    workers[i].join();
+  workers.clear();
+  heapFree(root);
+  root = NULL;
+  root_capacity = 0;
+}
+
+void autopilotTick ()
+{
+  if (workers.empty() || gameover)
+    return;
+  TRACE_SCOPE("autopilot");
+
+  unsigned int need = saveState(root, root ? root_capacity : 0);
+  if (need > root_capacity)
+  {
+    game_state* grown = (game_state*)heapRealloc(root, need * 2);
+    if (grown == NULL)
+      return;
+    root = grown;
+    root_capacity = need * 2;
+    saveState(root, root_capacity);
+  }
+  root_pattern = pattern;
+  // workers read the mirror hierarchy; have it built here before they start
+  beamPath();
+
+  candidates();
+  next_plan.store(0);
+  {
+    lock_guard<mutex> guard(pool_lock);
+    busy = workers.size();
+    generation++;
+  }
+  pool_wake.notify_all();
+  {
+    unique_lock<mutex> guard(pool_lock);
+    pool_done.wait(guard, [] { return busy == 0; });
+  }
+
+  // ties keep the current plan, so the inputs do not dither
+  int best = 0;
+  for (int k=1;k<num_plans;k++)
+    if (scores[k] > scores[best])
+      best = k;
+  autopilot_goal = plans[best];
+  autopilot_score = scores[best];
+
+  steer(autopilot_goal);
+  pullTrigger();
+}
@@ -0,0 +1,35 @@
+#ifndef AUTOPILOT_H
+#define AUTOPILOT_H
+
+/* Lookahead autopilot for soak tests.
+ *
+ * Every tick it snapshots the game, plays a set of candidate plans
+ * AUTOPILOT_LOOKAHEAD ticks ahead on a pool of worker threads and keeps the
+ * best scoring one. The real game is then moved one step towards that plan,
+ * at the same rates as the keys (0.01 rad of aim, 0.5 units of cannon or
+ * basket travel per tick), with the trigger held down.
+ *
+ * The simulation state is thread_local (see game.cpp), so each worker plays
+ * its own copy restored with loadState(); the level and mirrors are shared
+ * and must not change while the pool is running. */
+
+#define AUTOPILOT_LOOKAHEAD 180
+
+struct autopilot_plan {
+  float angle;      // cannon aim, radians
+  float cannon;     // cannon translate
+  float basket[2];  // basket translates
+};
+
+/* Starts threads workers, or one per core if 0 */
+void autopilotStart (int threads = 0, int lookahead = AUTOPILOT_LOOKAHEAD);
+void autopilotStop ();
+
+/* Plans and applies this tick's inputs. Call before snapshotTick()/stepGame() */
+void autopilotTick ();
+
+/* Plan being followed, and the score it was picked with */
+extern autopilot_plan autopilot_goal;
+extern float autopilot_score;
+
+#endif
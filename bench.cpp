@@ -0,0 +1,362 @@
+/* Micro-benchmarks for the hot game routines.
+ *
+ *   ./bench                       run everything
+ *   ./bench --filter score        only benchmarks whose name contains "score"
+ *   ./bench --min-time 1.0        seconds to spend on each benchmark
+ *   ./bench --csv results.csv     also write name,iterations,ns_per_op rows
+ *
+ * Every benchmark starts from initGame() with the same seed, so runs on
+ * different builds see identical inputs. */
+
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "arena.h"
+#include "game.h"
+#include "autopilot.h"
+#include "particles.h"
+
+using namespace std;
+
+#define BENCH_SEED 12345u
+
+static const char* bench_filter = NULL;
+static double bench_min_time = 0.25;
+static FILE* bench_csv = NULL;
+
+/* Keeps the compiler from discarding results it can prove unused */
+template <class T> static inline void keep (T const& value)
+{
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+/* Doubles the iteration count until one batch runs for at least bench_min_time */
+template <class F> static void run (const string& name, F body)
+{
+  if (bench_filter != NULL && name.find(bench_filter) == string::npos)
+    return;
+
+  long iterations = 1;
+  double elapsed = 0;
+  while (true)
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (long i = 0; i < iterations; i++)
+      body(i);
+    elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (elapsed >= bench_min_time || iterations >= (1L << 40))
+      break;
+    iterations *= 2;
+  }
+
+  double ns = elapsed * 1e9 / iterations;
+  printf("%-36s %14ld %14.1f\n", name.c_str(), iterations, ns);
+  if (bench_csv != NULL)
+    fprintf(bench_csv, "%s,%ld,%.3f\n", name.c_str(), iterations, ns);
+}
+
+static string label (const char* name, const char* k1, int v1, const char* k2 = NULL, int v2 = 0)
+{
+  char buf[128];
+  if (k2 == NULL)
+    snprintf(buf, sizeof(buf), "%s/%s:%d", name, k1, v1);
+  else
+    snprintf(buf, sizeof(buf), "%s/%s:%d/%s:%d", name, k1, v1, k2, v2);
+  return buf;
+}
+
+/* Fresh game with the bricks spread over the visible playfield instead of
+ * queued above it, so laser and catch tests have real work to do */
+static void field (int bricks)
+{
+  game_messages = false;
+  initGame(BENCH_SEED, bricks);
+  wheelInit(&timers, tick);
+  for (int i = 0; i < num_boxes; i++)
+  {
+    spawnBrick(i);
+    float y1 = nextRandom() % 72 - 34;
+    boxes[i].translation += y1 - boxes[i].y1;
+    boxes[i].y1 = y1;
+    boxes[i].y2 = y1 + rules.brick_h;
+  }
+  rescheduleCatches();
+}
+
+/* Beam segments fanning out from the cannon at seeded angles */
+static void aim (int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    float m = (nextRandom() % 1000) / 1000.0 * 1.4 - 0.7;
+    placeLaser(gun[1].x, gun[1].y, 0, 0, cos(m), sin(m), i);
+  }
+  beams = count;
+}
+
+static const int brick_counts[] = { 15, 150, 1500, MAX_BOXES };
+static const int beam_counts[] = { 1, 4, 10 };
+static const int mirror_counts[] = { 3, 128, MAX_MIRRORS };
+static const int bounce_limits[] = { 10, MAX_BEAMS };
+
+int main (int argc, char** argv)
+{
+  const char* csv_path = NULL;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--filter") == 0 && i+1 < argc)
+      bench_filter = argv[++i];
+    else if (strcmp(argv[i], "--min-time") == 0 && i+1 < argc)
+      bench_min_time = atof(argv[++i]);
+    else if (strcmp(argv[i], "--csv") == 0 && i+1 < argc)
+      csv_path = argv[++i];
+    else
+    {
+      fprintf(stderr, "usage: %s [--filter name] [--min-time seconds] [--csv file]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (csv_path != NULL)
+  {
+    bench_csv = fopen(csv_path, "w");
+    if (bench_csv == NULL)
+    {
+      fprintf(stderr, "bench: cannot open %s\n", csv_path);
+      return 1;
+    }
+    fprintf(bench_csv, "name,iterations,ns_per_op\n");
+  }
+
+  printf("%-36s %14s %14s\n", "benchmark", "iterations", "ns/op");
+
+  /* shoot(): the per-frame cost while a beam is visible is the nearest brick
+   * search; laserTarget() is that search without destroying the brick */
+  for (int b = 0; b < 4; b++)
+    for (int k = 0; k < 3; k++)
+    {
+      field(brick_counts[b]);
+      aim(beam_counts[k]);
+      run(label("shoot", "bricks", brick_counts[b], "beams", beam_counts[k]), [](long) {
+        float x, y;
+        for (int i = 0; i < beams; i++)
+          keep(laserTarget(i, &x, &y));
+      });
+    }
+
+  /* score(): resolves the catches due each tick while the field falls */
+  for (int b = 0; b < 4; b++)
+  {
+    field(brick_counts[b]);
+    run(label("score", "bricks", brick_counts[b]), [](long) {
+      score();
+      moveBricks();
+      tick++;
+      keep(points);
+    });
+  }
+
+  /* Beam tracer, cannon swept over seeded angles so every shot retraces.
+   * Beyond the three level mirrors the field is filled with random short ones */
+  for (int k = 0; k < 3; k++)
+    for (int b = 0; b < 2; b++)
+    {
+      field(15);
+      if (mirror_counts[k] > num_mirrors)
+      {
+        clearMirrors();
+        for (int i = 0; i < mirror_counts[k]; i++)
+        {
+          float x = nextRandom() % 70 - 30, y = nextRandom() % 76 - 38;
+          float a = (nextRandom() % 628) / 100.0;
+          addMirror(x, y, x + 3*cos(a), y + 3*sin(a));
+        }
+      }
+      beam_limit = bounce_limits[b];
+
+      static float angles[64];
+      for (int i = 0; i < 64; i++)
+        angles[i] = (nextRandom() % 1000) / 1000.0 * 1.4 - 0.7;
+      run(label("fireLaser", "mirrors", mirror_counts[k], "bounces", bounce_limits[b]), [](long n) {
+        aimCannon(angles[n & 63]);
+        keep(fireLaser());
+      });
+
+      // aim and mirrors unchanged, the path comes from the cache
+      run(label("beamPath/cached", "mirrors", mirror_counts[k], "bounces", bounce_limits[b]), [](long) {
+        keep(beamPath().segments);
+      });
+      beam_limit = 10;
+    }
+
+  /* createRectangle() minus the GL upload */
+  for (int b = 0; b < 2; b++)
+  {
+    field(brick_counts[b]);
+    int n = brick_counts[b];
+    run(label("spawnBrick", "bricks", n), [n](long i) {
+      spawnBrick(i % n);
+      keep(boxes[i % n]);
+    });
+  }
+
+  /* Brick update loop from main(): catches and respawns, then the fall */
+  for (int b = 0; b < 4; b++)
+  {
+    field(brick_counts[b]);
+    run(label("moveBricks", "bricks", brick_counts[b]), [](long) {
+      moveBricks();
+      keep(boxes[0]);
+    });
+
+    field(brick_counts[b]);
+    run(label("brick_update", "bricks", brick_counts[b]), [](long) {
+      stepGame();
+      keep(boxes[0]);
+    });
+  }
+
+  /* Snapshot and rollback of the whole game state, after a second of play */
+  for (int b = 0; b < 3; b++)
+  {
+    field(brick_counts[b]);
+    for (int t = 0; t < TICK_RATE; t++)
+    {
+      pullTrigger();
+      stepGame();
+    }
+    static vector<char> buf;
+    buf.resize(saveState(NULL, 0));
+    game_state* s = (game_state*)&buf[0];
+    saveState(s, buf.size());
+    run(label("saveState", "bricks", brick_counts[b]), [s](long) {
+      keep(saveState(s, buf.size()));
+    });
+    run(label("loadState", "bricks", brick_counts[b]), [s](long) {
+      loadState(s);
+      keep(boxes[0]);
+    });
+    run(label("snapshotTick", "bricks", brick_counts[b]), [](long) {
+      snapshotTick();
+      keep(tick);
+    });
+    run(label("stateHash", "bricks", brick_counts[b]), [](long) {
+      keep(stateHash());
+    });
+  }
+
+  /* A frame's worth of small transient allocations, then the reset */
+  {
+    static frame_arena a;
+    arenaInit(&a, 64*1024);
+    run("arena/frame", [](long) {
+      for (int i = 0; i < 64; i++)
+        keep(arenaArray<float>(&a, 18));
+      arenaReset(&a);
+    });
+    arenaFree(&a);
+  }
+
+  /* A frame of debris: every live particle moved one tick, the dead dropped
+   * and the pool topped back up with fresh bursts */
+  {
+    static particle_pool pool;
+    particlesInit(&pool);
+    static rect brick = { -1, 1, 10, 12, 0, 1, true, 0 };
+    const int live[] = { 1000, 10000, 100000 };
+    for (int b = 0; b < 3; b++)
+    {
+      static int target;
+      target = live[b];
+      pool.count = 0;
+      while (pool.count < target)
+        emitDebris(&pool, brick, DEBRIS_PER_HIT);
+      run(label("particles", "live", target), [](long) {
+        updateParticles(&pool, 1);
+        while (pool.count < target)
+          emitDebris(&pool, brick, DEBRIS_PER_HIT);
+        keep(pool.count);
+      });
+    }
+    particlesFree(&pool);
+  }
+
+  /* One planning tick of the autopilot: every candidate plan played
+   * AUTOPILOT_LOOKAHEAD ticks ahead, one worker per core */
+  autopilotStart();
+  for (int b = 0; b < 3; b++)
+  {
+    field(brick_counts[b]);
+    run(label("autopilotTick", "bricks", brick_counts[b]), [](long) {
+      autopilotTick();
+      keep(autopilot_score);
+    });
+  }
+  autopilotStop();
+
+  /* Level switch: map a compiled level, start a game on it, unmap it */
+  for (int k = 0; k < 3; k++)
+  {
+    char src[64], lvl[64];
+    snprintf(src, sizeof(src), "/tmp/bench_level_%d.txt", (int)getpid());
+    snprintf(lvl, sizeof(lvl), "/tmp/bench_level_%d.lvl", (int)getpid());
+    FILE* f = fopen(src, "w");
+    for (int i = 0; f != NULL && i < mirror_counts[k]; i++)
+    {
+      float x = nextRandom() % 70 - 30, y = nextRandom() % 76 - 38;
+      float a = (nextRandom() % 628) / 100.0;
+      fprintf(f, "mirror %g %g %g %g\n", x, y, x + 3*cos(a), y + 3*sin(a));
+    }
+    if (f == NULL || fclose(f) != 0 || !compileLevel(src, lvl))
+    {
+      fprintf(stderr, "bench: cannot build a level in /tmp\n");
+      continue;
+    }
+    static const char* path;
+    path = lvl;
+    run(label("loadLevel", "mirrors", mirror_counts[k]), [](long n) {
+      const level_file* l = mapLevel(path);
+      useLevel(l);
+      initGame(BENCH_SEED + n);
+      keep(num_mirrors);
+      useLevel(NULL);
+      unmapLevel(l);
+    });
+    remove(src);
+    remove(lvl);
+  }
+
+  /* Pattern playback: one spawn record read off a looping pattern of 100000 */
+  {
+    char src[64], bbp[64];
+    snprintf(src, sizeof(src), "/tmp/bench_pattern_%d.txt", (int)getpid());
+    snprintf(bbp, sizeof(bbp), "/tmp/bench_pattern_%d.bbp", (int)getpid());
+    FILE* f = fopen(src, "w");
+    if (f != NULL)
+      fprintf(f, "wave 0 100000 2 * 0 *\nloop 200000\n");
+    static spawn_pattern p;
+    if (f == NULL || fclose(f) != 0 || !compilePattern(src, bbp) || !openPattern(&p, bbp))
+      fprintf(stderr, "bench: cannot build a pattern in /tmp\n");
+    else
+    {
+      run("pattern/stream", [](long) {
+        long due;
+        keep(nextSpawn(&p, &due));
+        popSpawn(&p);
+      });
+      closePattern(&p);
+    }
+    remove(src);
+    remove(bbp);
+  }
+
+  if (bench_csv != NULL)
+    fclose(bench_csv);
+  return 0;
+}
@@ -1,7 +1,12 @@
 #include <iostream>
+#include <cctype>
 #include <cmath>
-#include <fstream>
-#include <vector>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <thread>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -11,6 +16,15 @@
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "arena.h"
+#include "filewatch.h"
+#include "game.h"
+#include "autopilot.h"
+#include "netplay.h"
+#include "particles.h"
+#include "spectate.h"
+#include "trace.h"
+
 using namespace std;
 
 struct VAO {
@@ -21,74 +35,112 @@ struct VAO {
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+
+    // bounding box of the vertices in model space, for culling
+    float MinX, MinY, MaxX, MaxY;
 };
 typedef struct VAO VAO;
 
 struct GLMatrices {
-	glm::mat4 projection;
-	glm::mat4 model;
-	glm::mat4 view;
 	GLuint MatrixID;
 } Matrices;
 
-GLuint programID;
-
-/* Function to load Shaders - Use it as it is */
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
+/* Eye on the +z axis looking at the origin, ortho projection of the part of
+ * the playfield zoomFactor and panFactor select. updateCamera() rebuilds the
+ * matrices and the cursor mapping only when either changed, or after a
+ * resize cleared valid */
+struct camera {
+  float zoom, pan;   // what VP was built for
+  bool valid;
+  glm::mat4 projection, view, VP;
+  float left, right, bottom, top;  // world rectangle on screen
+  // window units (the cursor's) to world: x*to_world[0] + to_world[1],
+  // y*to_world[2] + to_world[3]
+  float to_world[4];
+} cam;
+
+/* Framebuffer size in pixels and window size in screen units, kept by
+ * reshapeWindow; they differ on HiDPI displays */
+int fb_width, fb_height;
+int win_width, win_height;
+
+/* Set when the window needs repainting whatever the game did (resize, damage) */
+bool redraw = true;
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+GLuint programID;
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open())
+/* Whole file as a NUL terminated string in arena a; empty if it cannot be read */
+static const char* readShader (const char* path, frame_arena* a)
+{
+	FILE* f = fopen(path, "rb");
+	long size = 0;
+	if (f != NULL && fseek(f, 0, SEEK_END) == 0)
+		size = ftell(f);
+	if (size < 0)
+		size = 0;
+	char* code = arenaArray<char>(a, size + 1);
+	if (f != NULL)
 	{
-		std::string Line = "";
-		while(getline(VertexShaderStream, Line))
-			VertexShaderCode += "\n" + Line;
-		VertexShaderStream.close();
+		rewind(f);
+		size = fread(code, 1, size, f);
+		fclose(f);
 	}
+	code[size] = '\0';
+	return code;
+}
 
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::string Line = "";
-		while(getline(FragmentShaderStream, Line))
-			FragmentShaderCode += "\n" + Line;
-		FragmentShaderStream.close();
+/* Prints a shader's or program's info log, read into arena a. Whether it
+ * compiled or linked */
+static bool printLog (GLuint id, bool program, frame_arena* a)
+{
+	int InfoLogLength = 0, ok = GL_FALSE;
+	if (program)
+	{
+		glGetProgramiv(id, GL_LINK_STATUS, &ok);
+		glGetProgramiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	}
+	else
+	{
+		glGetShaderiv(id, GL_COMPILE_STATUS, &ok);
+		glGetShaderiv(id, GL_INFO_LOG_LENGTH, &InfoLogLength);
 	}
+	char* message = arenaArray<char>(a, max(InfoLogLength, 1));
+	message[0] = '\0';
+	if (program)
+		glGetProgramInfoLog(id, InfoLogLength, NULL, message);
+	else
+		glGetShaderInfoLog(id, InfoLogLength, NULL, message);
+	fprintf(stdout, "%s\n", message);
+	return ok == GL_TRUE;
+}
+
+/* Function to load Shaders. The sources and logs are temporaries in arena a.
+ * 0 if either shader does not compile or the program does not link */
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path, frame_arena* a = &frame) {
+
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
 
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
+	// Read the shader code from the files
+	const char* VertexSourcePointer = readShader(vertex_file_path, a);
+	const char* FragmentSourcePointer = readShader(fragment_file_path, a);
 
 	// Compile Vertex Shader
 	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
 	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
 	glCompileShader(VertexShaderID);
 
 	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> VertexShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &VertexShaderErrorMessage[0]);
+	bool ok = printLog(VertexShaderID, false, a);
 
 	// Compile Fragment Shader
 	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
 
 	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> FragmentShaderErrorMessage(InfoLogLength);
-	glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-	fprintf(stdout, "%s\n", &FragmentShaderErrorMessage[0]);
+	ok = printLog(FragmentShaderID, false, a) && ok;
 
 	// Link the program
 	fprintf(stdout, "Linking program\n");
@@ -98,15 +150,16 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	glLinkProgram(ProgramID);
 
 	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	std::vector<char> ProgramErrorMessage( max(InfoLogLength, int(1)) );
-	glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-	fprintf(stdout, "%s\n", &ProgramErrorMessage[0]);
+	ok = printLog(ProgramID, true, a) && ok;
 
 	glDeleteShader(VertexShaderID);
 	glDeleteShader(FragmentShaderID);
 
+	if (!ok)
+	{
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
 	return ProgramID;
 }
 
@@ -115,21 +168,42 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+/* Ends the main loop; the window and the GL objects are torn down after it,
+ * while the context is still current */
 void quit(GLFWwindow *window)
 {
-    glfwDestroyWindow(window);
-    glfwTerminate();
-//    exit(EXIT_SUCCESS);
+    glfwSetWindowShouldClose(window, GL_TRUE);
 }
 
+/* GL objects alive now, kept by create3DObject/destroy3DObject and the HUD */
+struct gl_stats {
+    long vaos;
+    long buffers;
+    long textures;
+    long long buffer_bytes;
+} gl_live;
+
 /* Generate VAO, VBOs and return VAO handle */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
 {
+    TRACE_INSTANT("create3DObject", numVertices);
     struct VAO* vao = new struct VAO;
+    gl_live.vaos++;
+    gl_live.buffers += 2;
+    gl_live.buffer_bytes += 2*3*numVertices*sizeof(GLfloat);
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
     vao->FillMode = fill_mode;
 
+    vao->MinX = vao->MinY = numVertices > 0 ? 1e30f : 0;
+    vao->MaxX = vao->MaxY = numVertices > 0 ? -1e30f : 0;
+    for (int i=0; i<numVertices; i++) {
+        vao->MinX = min(vao->MinX, vertex_buffer_data[3*i]);
+        vao->MaxX = max(vao->MaxX, vertex_buffer_data[3*i]);
+        vao->MinY = min(vao->MinY, vertex_buffer_data[3*i + 1]);
+        vao->MaxY = max(vao->MaxY, vertex_buffer_data[3*i + 1]);
+    }
+
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
     glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
@@ -162,10 +236,11 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return vao;
 }
 
-/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
+/* Generate VAO, VBOs and return VAO handle - Common Color for all vertices.
+ * glBufferData copies the colours, so they only need to last the frame */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    GLfloat* color_buffer_data = arenaArray<GLfloat>(&frame, 3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
@@ -175,6 +250,20 @@ struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloa
     return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
 }
 
+/* Deletes the VAO, its VBOs and the handle */
+void destroy3DObject (struct VAO* vao)
+{
+    if (vao == NULL)
+        return;
+    glDeleteBuffers (1, &vao->VertexBuffer);
+    glDeleteBuffers (1, &vao->ColorBuffer);
+    glDeleteVertexArrays (1, &vao->VertexArrayID);
+    gl_live.vaos--;
+    gl_live.buffers -= 2;
+    gl_live.buffer_bytes -= 2*3*vao->NumVertices*sizeof(GLfloat);
+    delete vao;
+}
+
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
@@ -202,63 +291,11 @@ void draw3DObject (struct VAO* vao)
  * Customizable functions *
  **************************/
 
-struct rect{
-	float x1;
-	float x2;	
-	float y1;
-	float y2;
-	float translation;	
-	int c;
-	bool alive;
-};
-
-struct receptacle{
-  float x1;
-  float x2;
-  float translate;
-  int c;
-};
-
-struct cannon{
-  float x;
-  float y;  
-  float translate;
-  float rotate; 
-};
-
-struct reflectors{
-  float x1;
-  float x2; 
-  float y1;
-  float y2;
-  float m;
-  float c;
-};
-
-struct rail{
-  float x1;
-  float x2; 
-  float y1;
-  float y2;
-  float m;
-  float c;	
-};
-
-int points = 0;
-bool gameover = false;
-int hit_count = 0;
-float speed = 0.1;
 float zoomFactor = 1.0;
 float panFactor = 0;
 double mouseX;
 double mouseY;
 
-rect boxes[15];
-receptacle bucket[2];
-cannon gun[2];
-reflectors mirror[3];
-rail bullet[10];
-
 bool keystates_pressed[350];
 bool mouse_keystates_pressed[8];
 bool mouse_keystates_released[8];
@@ -281,13 +318,77 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
     }
 }
 
+/* Simulation speed relative to real time, slowest first. The game runs
+ * TICK_RATE times the scale ticks per second of wall time, whatever the
+ * display's refresh rate */
+static const float time_scales[] = { 0.125f, 0.25f, 0.5f, 1, 2, 4, 8, 16, 32, 64, 100 };
+#define TIME_SCALES (int)(sizeof(time_scales)/sizeof(time_scales[0]))
+#define NORMAL_SPEED 3
+/* Longest gap between frames that is caught up on; past a stall (a dragged
+ * window, a breakpoint) the game carries on rather than bursting */
+#define MAX_FRAME_GAP 0.1
+
+/* Decides how many ticks each rendered frame runs */
+struct time_control {
+  bool paused;
+  int steps;      // single steps asked for while paused
+  int scale;      // index into time_scales
+  double pending; // part of a tick carried over to the next frame
+  double last;    // glfwGetTime() at the previous frame, < 0 before the first
+} timectl = { false, 0, NORMAL_SPEED, 0, -1 };
+
+/* Fraction of the way from this tick to the next that the frame shows */
+float tick_alpha = 0;
+
+/* Ticks to run this frame, and tick_alpha for drawing it */
+int ticksDue ()
+{
+  double now = glfwGetTime();
+  double elapsed = timectl.last < 0 ? 0 : now - timectl.last;
+  timectl.last = now;
+  if (timectl.paused)
+  {
+    int n = timectl.steps;
+    timectl.steps = 0;
+    tick_alpha = 0;
+    return n;
+  }
+  if (elapsed > MAX_FRAME_GAP)
+    elapsed = MAX_FRAME_GAP;
+  timectl.pending += elapsed * TICK_RATE * time_scales[timectl.scale];
+  int n = (int)timectl.pending;
+  timectl.pending -= n;
+  tick_alpha = (float)timectl.pending;
+  return n;
+}
+
 /* Executed for character input (like in text boxes) */
 void keyboardChar (GLFWwindow* window, unsigned int key)
 {
+	// a networked game runs in step with the peer, whatever the local speed
+	if (net_active && key != 'Q' && key != 'q')
+		return;
 	switch (key) {
 		case 'Q':
 		case 'q':
             quit(window);
+            break;
+		case 'P':
+		case 'p':
+            timectl.paused = !timectl.paused;
+            timectl.pending = 0;
+            break;
+		case '.':
+            if (timectl.paused)
+                timectl.steps++;
+            break;
+		case '[':
+            if (timectl.scale > 0)
+                timectl.scale--;
+            break;
+		case ']':
+            if (timectl.scale < TIME_SCALES-1)
+                timectl.scale++;
             break;
 		default:
 			break;
@@ -317,6 +418,8 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     /* With Retina display on Mac OS X, GLFW's FramebufferSize
      is different from WindowSize */
     glfwGetFramebufferSize(window, &fbwidth, &fbheight);
+    // this is called for both, so neither argument can be trusted to be either
+    glfwGetWindowSize(window, &win_width, &win_height);
 
 	GLfloat fov = 90.0f;
 
@@ -331,86 +434,28 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
     // Perspective projection for 3D views
     // Matrices.projection = glm::perspective (fov, (GLfloat) fbwidth / (GLfloat) fbheight, 0.1f, 500.0f);
 
-    // Ortho projection for 2D views
-    Matrices.projection = glm::ortho(-40.0f, 40.0f, -40.0f, 40.0f, 0.1f, 500.0f);
+    // Ortho projection for 2D views, rebuilt by the next draw()
+    cam.valid = false;
+    fb_width = fbwidth;
+    fb_height = fbheight;
+    redraw = true;
 }
 
-VAO *laser[10], *cannon_t1, *cannon_t2, *cannon_r1, *cannon_r2, *rectangle[40], *basket1, *basket2, *mirror1, *mirror2, *mirror3, *line;
+VAO *beam, *cannon_t1, *cannon_t2, *cannon_r1, *cannon_r2, *brick[3], *basket1, *basket2, *reflector, *line;
 
-// Creates the triangle object used in this sample code
-void createCannon ()
+/* Uploads one of the level's meshes; the arrays go from the mapped file straight into the VBOs */
+VAO* createLevelMesh (int id)
 {
-  /* Define vertex array as used in glBegin (GL_TRIANGLES) */
-  static const GLfloat vertex_buffer_data_t1 [] = {
-    -40,6,0, // vertex 1
-    -36,0,0, // vertex 2
-    -40,-6,0 // vertex 3
-  };
-
-  static const GLfloat color_buffer_data_t1 [] = {
-    0.3,0.3,0.3, // color 1
-    0.3,0.3,0.3, // color 2
-    0.3,0.3,0.3  // color 3
-  };
-
-  cannon_t1 = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data_t1, color_buffer_data_t1, GL_FILL);
-
-  static const GLfloat vertex_buffer_data_t2 [] = {
-    -40,5,0, // vertex 1
-    -36.5,0,0, // vertex 2
-    -40,-5,0 // vertex 3
-  };
-
-  static const GLfloat color_buffer_data_t2 [] = {
-    1,1,1, // color 1
-    1,1,1, // color 2
-    1,1,1  // color 3
-  };
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  cannon_t2 = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data_t2, color_buffer_data_t2, GL_FILL);
-
-  const GLfloat color_buffer_data_r [] = {
-    0.2,0.2,0, // color 1
-    0.2,0.2,0, // color 2
-    0.2,0.2,0, // color 3
-
-    0.2,0.2,0, // color 3
-    0.2,0.2,0, // color 4
-    0.2,0.2,0  // color 1
-  };
-
-  const GLfloat vertex_buffer_data_r1 [] = {
-  	-39,2.2,0,  // vertex 1
-  	-39,-2.2,0, // vertex 2
-  	-34.5,-1.7,0, // vertex 3
-
-  	-39,2.2,0,  // vertex 1
-  	-34.5,-1.7,0, // vertex 3
-  	-34.5,1.7,0  // vertex 4  	
-  };
-
-  gun[0].x = -39;
-  gun[0].y = 0;
-  gun[0].translate = 0.0;
-
-  cannon_r1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_r1, color_buffer_data_r, GL_FILL);
-
-  const GLfloat vertex_buffer_data_r2 [] = {
-  	-35.5,1.2,0,  // vertex 1
-  	-35.5,-1.2,0, // vertex 2
-  	-31,-0.7,0, // vertex 3
-
-  	-35.5,1.2,0,  // vertex 1
-  	-31,-0.7,0, // vertex 3
-  	-31,0.7,0  // vertex 4  	
-  };
-
-  gun[1].x = -31;
-  gun[1].y = 0;
-  gun[1].translate = 0.0;
+  const level_mesh& m = level->mesh[id];
+  return create3DObject(GL_TRIANGLES, m.vertices, levelFloats(level, m.vertex_offset), levelFloats(level, m.color_offset), GL_FILL);
+}
 
-  cannon_r2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_r2, color_buffer_data_r, GL_FILL);
+void createCannon ()
+{
+  cannon_t1 = createLevelMesh(MESH_CANNON_OUTER);
+  cannon_t2 = createLevelMesh(MESH_CANNON_INNER);
+  cannon_r1 = createLevelMesh(MESH_BARREL_REAR);
+  cannon_r2 = createLevelMesh(MESH_BARREL_FRONT);
 }
 
 // Creates the triangle object used in this sample code
@@ -430,83 +475,17 @@ void createLine ()
   line = create3DObject(GL_LINES, 2, vertex_buffer_data, color_buffer_data, GL_LINE);
 }
 
-int y = 0;
-
-void createRectangle (int i)
+/* One brick per colour at the origin, placed with the model matrix when drawn */
+void createBricks ()
 {
-  int x,c,r,g,b;
-
-  x = rand() % 50 - 20;
-  y += rand() % 20;
-  c = rand() % 3;
-
-  // red = 1
-  if (c == 1){
-  	r = 0; g = -1; b = -1;
-  }
-  // green = 2
-  else if (c == 2){
-  	r = -1; g = 0; b = -1;
-  }
-  // black
-  else{
-  	r = -1; g = -1; b = -1;
-  }
-
-  boxes[i].x1 = x;
-  boxes[i].x2 = x+1.5;
-  boxes[i].y1 = 42+y;
-  boxes[i].y2 = 44.5+y;
-  boxes[i].c = c;
-  boxes[i].alive = true;
-  boxes[i].translation = 0.0f;
-
-  // GL3 accepts only Triangles. Quads are not supported
-  const GLfloat vertex_buffer_data [] = {
-      boxes[i].x1, boxes[i].y1, 0,
-      boxes[i].x2, boxes[i].y1, 0,
-      boxes[i].x2, boxes[i].y2, 0,
-
-      boxes[i].x2, boxes[i].y2, 0,
-      boxes[i].x1, boxes[i].y2, 0,
-      boxes[i].x1, boxes[i].y1, 0
-    };
-
-    const GLfloat color_buffer_data [] = {
-      1+r,1+g,1+b, // color 1
-      1+r,1+g,1+b, // color 2
-      1+r,1+g,1+b, // color 3
-
-      1+r,1+g,1+b, // color 3
-      1+r,1+g,1+b, // color 4
-      1+r,1+g,1+b // color 1
-    };
-
-    // create3DObject creates and returns a handle to a VAO that can be used later
-    rectangle[i] = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);    
+  for (int c=0; c<3; c++)
+    brick[c] = createLevelMesh(MESH_BRICK0 + c);
 }
 
-void createLaser (float x1, float y1, float x2, float y2, float m, float c, int i)
+/* Unit length laser beam along +x, stretched and rotated onto each segment when drawn */
+void createBeam ()
 {
-  float t_x,t_y;
-
-  t_x = 0.25*sin(m);
-  t_y = 0.25*cos(m);
-
-  if (x2 == 0 && y2 == 0)
-  {
-    x2 = x1+100*cos(m);
-    y2 = y1+100*sin(m);
-  }
-
-  bullet[i].x1 = x1;
-  bullet[i].x2 = x2;
-  bullet[i].y1 = y1;
-  bullet[i].y2 = y2;  
-  bullet[i].m = m;
-  bullet[i].c = c;  
-
-  const GLfloat color_buffer_data [] = {
+  static const GLfloat color_buffer_data [] = {
     0,0,1, // color 1
     0,0,1, // color 2
     0,0,1, // color 3
@@ -516,22 +495,23 @@ void createLaser (float x1, float y1, float x2, float y2, float m, float c, int
     0,0,1  // color 1
   };
 
-  const GLfloat vertex_buffer_data [] = {
-    x1-t_x,y1+t_y,0,
-    x1+t_x,y1-t_y,0,
-    x2+t_x,y2-t_y,0,
+  static const GLfloat vertex_buffer_data [] = {
+    0,0.25,0,
+    0,-0.25,0,
+    1,-0.25,0,
 
-    x1-t_x,y1+t_y,0,
-    x2-t_x,y2+t_y,0,
-    x2+t_x,y2-t_y,0,
+    0,0.25,0,
+    1,0.25,0,
+    1,-0.25,0,
   };
 
-  laser[i] = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
+  beam = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-void createMirrors ()
+/* Unit length mirror along +x, stretched and rotated onto each reflector when drawn */
+void createMirror ()
 {
-  const GLfloat color_buffer_data [] = {
+  static const GLfloat color_buffer_data [] = {
     0,0,0, // color 1
     0,0,0, // color 2
     0,0,0, // color 3
@@ -541,310 +521,83 @@ void createMirrors ()
     0,0,0  // color 1
   };
 
-  const GLfloat vertex_buffer_data_m1 [] = {
-    -1,-2,0, // vertex 1
-    4,-2+5*sqrt(3),0, // vertex 2
-    -1-0.2,-2+sqrt(3)/5,0, // vertex 3
-
-    -1-0.2,-2+sqrt(3)/5,0, // vertex 3    
-    4-0.2,-2+5*sqrt(3)+sqrt(3)/5,0, // vertex 4
-    4,-2+5*sqrt(3),0 // vertex 2
-  };
-
-  mirror[0].m = M_PI/3;
-  mirror[0].c = -2 + tan(mirror[0].m);
-  mirror[0].x1 = -1;
-  mirror[0].x2 = 4;
-  mirror[0].y1 = -2;
-  mirror[0].y2 = -2+5*sqrt(3);
-
-  mirror1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_m1, color_buffer_data, GL_FILL);    
-
-  const GLfloat vertex_buffer_data_m2 [] = {
-    28,-25,0, // vertex 1
-    36,-25+8/sqrt(3),0, // vertex 2
-    28-0.2,-25+sqrt(3)/5,0, // vertex 3
-
-    28-0.2,-25+sqrt(3)/5,0, // vertex 3
-    36-0.2,-25+8/sqrt(3)+sqrt(3)/5,0, // vertex 4
-    36,-25+8/sqrt(3),0 // vertex 2
-  };
-
-  mirror[1].m = M_PI/6;
-  mirror[1].c = -25 - 28*tan(mirror[1].m);
-  mirror[1].x1 = 28;
-  mirror[1].x2 = 36;
-  mirror[1].y1 = -25;
-  mirror[1].y2 = -25+8/sqrt(3);
-
-  mirror2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_m2, color_buffer_data, GL_FILL);    
-
-  const GLfloat vertex_buffer_data_m3 [] = {
-    25,32,0, // vertex 1
-    32,25,0, // vertex 2
-    32-0.4/sqrt(2),25-0.4/sqrt(2),0, // vertex 3
+  static const GLfloat vertex_buffer_data [] = {
+    0,0.1,0, // vertex 1
+    1,0.1,0, // vertex 2
+    1,-0.1,0, // vertex 3
 
-    32-0.4/sqrt(2),25-0.4/sqrt(2),0, // vertex 3
-    25-0.4/sqrt(2),32-0.4/sqrt(2),0, // vertex 4
-    25,32,0 // vertex 1
+    1,-0.1,0, // vertex 3
+    0,-0.1,0, // vertex 4
+    0,0.1,0 // vertex 1
   };
 
-  mirror[2].m = (3*M_PI)/4;
-  mirror[2].c = 32 - 25*tan(mirror[2].m);
-  mirror[2].x1 = 25;
-  mirror[2].x2 = 32;
-  mirror[2].y1 = 32;
-  mirror[2].y2 = 25;
-
-  mirror3 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_m3, color_buffer_data, GL_FILL);    
+  reflector = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, color_buffer_data, GL_FILL);
 }
 
-// Creates the rectangle object used in this sample code
 void createBasket ()
 {
-  // GL3 accepts only Triangles. Quads are not supported
-  const GLfloat vertex_buffer_data_b1 [] = {
-    12.5,-40.0,0, // vertex 1
-    19.5,-40.0,0, // vertex 2
-    21.5,-36.5,0, // vertex 3
-
-    21.5,-36.5,0, // vertex 3
-    10.5,-36.5,0, // vertex 4
-    12.5,-40.0,0 // vertex 1
-  };
-
-  const GLfloat color_buffer_data_b1 [] = {
-    0,1,0, // color 1
-    0,1,0, // color 2
-    0,1,0, // color 3
-
-    0,1,0, // color 3
-    0,1,0, // color 4
-    0,1,0, // color 1
-  };
-
-  bucket[0].x1 = 10.5;
-  bucket[0].x2 = 21.5;
-  bucket[0].c = 2;
-  bucket[0].translate = 0.0;
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  basket1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_b1, color_buffer_data_b1, GL_FILL);
-
-  const GLfloat vertex_buffer_data_b2 [] = {
-    -12.5,-40.0,0, // vertex 1
-    -19.5,-40.0,0, // vertex 2
-    -21.5,-36.5,0, // vertex 3
-
-    -21.5,-36.5,0, // vertex 3
-    -10.5,-36.5,0, // vertex 4
-    -12.5,-40.0,0 // vertex 1
-  };
-
-  const GLfloat color_buffer_data_b2 [] = {
-    1,0,0, // color 1
-    1,0,0, // color 2
-    1,0,0, // color 3
-
-    1,0,0, // color 3
-    1,0,0, // color 4
-    1,0,0, // color 1
-  };
-
-  bucket[1].x2 = -10.5;
-  bucket[1].x1 = -21.5;
-  bucket[1].c = 1;
-  bucket[1].translate = 0.0;
-
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  basket2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data_b2, color_buffer_data_b2, GL_FILL);  
-}
-
-void translateBaskets ()
-{
-  if (keystates_pressed[GLFW_KEY_LEFT_CONTROL] && keystates_pressed[GLFW_KEY_RIGHT] && !keystates_released[GLFW_KEY_RIGHT])
-  {
-    bucket[1].translate += 0.5;
-    bucket[1].x1 += 0.5;
-    bucket[1].x2 += 0.5;
-  }
-  else if (keystates_pressed[GLFW_KEY_LEFT_CONTROL] && keystates_pressed[GLFW_KEY_LEFT] && !keystates_released[GLFW_KEY_LEFT])
-  {
-    bucket[1].translate -= 0.5;
-    bucket[1].x1 -= 0.5;
-    bucket[1].x2 -= 0.5;
-  }
-  else if (keystates_pressed[GLFW_KEY_LEFT_ALT] && keystates_pressed[GLFW_KEY_RIGHT] && !keystates_released[GLFW_KEY_RIGHT])
-  {
-    bucket[0].translate += 0.5;
-    bucket[0].x1 += 0.5;
-    bucket[0].x2 += 0.5;
-  }
-  else if (keystates_pressed[GLFW_KEY_LEFT_ALT] && keystates_pressed[GLFW_KEY_LEFT] && !keystates_released[GLFW_KEY_LEFT])
-  {
-    bucket[0].translate -= 0.5;
-    bucket[0].x1 -= 0.5;
-    bucket[0].x2 -= 0.5;
-  }
-}
-
-void translateCannon ()
-{
-   if (keystates_pressed[GLFW_KEY_S] && !keystates_released[GLFW_KEY_S])
-   {
-     gun[0].translate += 0.5;
-     gun[0].y += 0.5;
-
-     gun[1].translate += 0.5;
-     gun[1].y += 0.5;
-   }
-   else if (keystates_pressed[GLFW_KEY_F] && !keystates_released[GLFW_KEY_F])
-   {
-     gun[0].translate -= 0.5;
-     gun[0].y -= 0.5;
-
-     gun[1].translate -= 0.5;
-     gun[1].y -= 0.5;
-   }
+  basket1 = createLevelMesh(MESH_BASKET0);
+  basket2 = createLevelMesh(MESH_BASKET1);
 }
 
-void rotateCannon ()
+/* This frame's keys for a game on one machine, a mask per basket: Ctrl
+ * with the arrows moves the green basket and Alt the red one. The cannon,
+ * the trigger and the brick speed ride on the red basket's mask. They are
+ * applied once per tick with applyInput(), like a networked game's, so a
+ * paused frame changes nothing and slow motion and fast forward move the
+ * baskets as far per tick of fall as x1 does */
+void localKeys (uint16_t keys[2])
 {
-   if (keystates_pressed[GLFW_KEY_A] && !keystates_released[GLFW_KEY_A])
-   {
-     gun[0].rotate += 0.01;
-     gun[1].rotate += 0.01;
-   }
-   else if (keystates_pressed[GLFW_KEY_D] && !keystates_released[GLFW_KEY_D])
-   {
-     gun[0].rotate -= 0.01;
-     gun[1].rotate -= 0.01;
-   }
-}
-
-void score ()
-{
-  for (int i=0;i<15;i++)
-  {
-    for (int j=0;j<2;j++)
-    {
-      if (boxes[i].x1 >= bucket[j].x1 && boxes[i].x2 <= bucket[j].x2 && boxes[i].y2 <= -36)
-      {
-        if (bucket[j].c == boxes[i].c)
-        {
-          points += 10;
-          cout<<"Nice catch, you earned 10 points"<<endl;
-		      cout<<"Score = "<<points<<endl;
-        }
-        else if (boxes[i].c == 0)
-        {
-          cout<<"You caught the black brick!"<<endl;
-          cout<<"GAMEOVER"<<endl;
-          gameover = true;
-        }
-        else
-        {
-          points -= 5;
-          cout<<"Oops, wrong basket, you lose 5 points"<<endl;
-		      cout<<"Score = "<<points<<endl;
-        }
-      }
-    }
-  }
+  keys[0] = keys[1] = 0;
+  int side = keystates_pressed[GLFW_KEY_LEFT_CONTROL] ? 1 : keystates_pressed[GLFW_KEY_LEFT_ALT] ? 0 : -1;
+  if (side >= 0 && keystates_pressed[GLFW_KEY_RIGHT])
+    keys[side] |= INPUT_BASKET_RIGHT;
+  else if (side >= 0 && keystates_pressed[GLFW_KEY_LEFT])
+    keys[side] |= INPUT_BASKET_LEFT;
+  if (keystates_pressed[GLFW_KEY_S])
+    keys[0] |= INPUT_CANNON_UP;
+  else if (keystates_pressed[GLFW_KEY_F])
+    keys[0] |= INPUT_CANNON_DOWN;
+  if (keystates_pressed[GLFW_KEY_A])
+    keys[0] |= INPUT_AIM_UP;
+  else if (keystates_pressed[GLFW_KEY_D])
+    keys[0] |= INPUT_AIM_DOWN;
+  if (keystates_pressed[GLFW_KEY_SPACE])
+    keys[0] |= INPUT_FIRE;
+  if (keystates_pressed[GLFW_KEY_N])
+    keys[0] |= INPUT_FASTER;
+  if (keystates_pressed[GLFW_KEY_M])
+    keys[0] |= INPUT_SLOWER;
 }
 
-void shoot(int i)
+/* This tick's keys for a networked game: the same keys as alone, but either
+ * Ctrl or Alt with the arrows moves this player's own basket. They only go
+ * through netTick(), so both games apply them on the same tick */
+uint16_t netKeys ()
 {
-  int j, min;
-  float x,y,m,c,x2,y2;
-
-  m = tan(bullet[i].m);
-  c = bullet[i].c;
-
-  x2 = bullet[i].x2;
-  y2 = bullet[i].y2;  
-  min = -1;
-
-  for (j=0;j<15;j++)
-  {
- 	x = boxes[j].x1;
-  	y = m*x + c;
-  	if (boxes[j].y1 <= y && boxes[j].y2 >= y && boxes[j].y1 < 40 && boxes[j].y2 > -36)
-    {
-      if (x < x2)
-      {
-        x2 = x;
-        y2 = y;
-        min = j;
-      }
-    }
-
-  	x = boxes[j].x2;
-  	y = m*x + c;
-  	if (boxes[j].y1 <= y && boxes[j].y2 >= y && boxes[j].y1 < 40 && boxes[j].y2 > -36)
-    {
-      if (x < x2)
-      {
-        x2 = x;
-        y2 = y;
-        min = j;
-      }
-    }
-  }
-
-  if (min != -1)
+  uint16_t keys = 0;
+  if (keystates_pressed[GLFW_KEY_LEFT_CONTROL] || keystates_pressed[GLFW_KEY_LEFT_ALT])
   {
-      if (boxes[min].c > 0)
-      {
-        hit_count ++;
-        points += 10;
-		    cout<<"Nice shot, you earned 10 points"<<endl;
-        cout<<"Score = "<<points<<endl;
-        if (hit_count >= 500)
-        {
-          cout<<"This was your 500th hit. Remember next time that you have only limited lasers."<<endl;
-          cout<<"GAMEOVER"<<endl;
-          gameover = true;
-        }
-        else if (hit_count >= 400)
-          cout<<"Use your lasers wisely. You have only "<<hit_count<<" remaining"<<endl;        
-      }
-      else if (boxes[min].c == 0)
-      {
-        hit_count += 5;
-        points -= 5;
-        cout<<"Whoops you shot a black brick, you lose 5 points and 5 lasers"<<endl;
-        cout<<"Score = "<<points<<endl;
-        if (hit_count >= 500)
-        {
-          cout<<"This was your 500th hit. Remember next time that you have only limited lasers."<<endl;
-          cout<<"GAMEOVER"<<endl;
-          gameover = true;
-        }
-        else if (hit_count >= 400)
-          cout<<"Use your lasers wisely. You have only "<<hit_count<<" remaining"<<endl;        
-      }
-      createLaser(bullet[i].x1,bullet[i].y1,x2,y2,bullet[i].m,bullet[i].c,i);
-      for (int k = i+1;k<10;k++)
-        laser[k] = NULL;
-      createRectangle(min);
+    if (keystates_pressed[GLFW_KEY_RIGHT])
+      keys |= INPUT_BASKET_RIGHT;
+    else if (keystates_pressed[GLFW_KEY_LEFT])
+      keys |= INPUT_BASKET_LEFT;
   }
-}
-
-void block_speed()
-{
+  if (keystates_pressed[GLFW_KEY_S])
+    keys |= INPUT_CANNON_UP;
+  else if (keystates_pressed[GLFW_KEY_F])
+    keys |= INPUT_CANNON_DOWN;
+  if (keystates_pressed[GLFW_KEY_A])
+    keys |= INPUT_AIM_UP;
+  else if (keystates_pressed[GLFW_KEY_D])
+    keys |= INPUT_AIM_DOWN;
+  if (keystates_pressed[GLFW_KEY_SPACE])
+    keys |= INPUT_FIRE;
   if (keystates_pressed[GLFW_KEY_N])
-  {
-    speed += 0.1;
-    if (speed > 0.5)
-      speed = 0.5;
-  }
+    keys |= INPUT_FASTER;
   if (keystates_pressed[GLFW_KEY_M])
-  {
-    speed -= 0.1;
-    if (speed < 0.1)
-      speed = 0.1;
-  }
+    keys |= INPUT_SLOWER;
+  return keys;
 }
 
 void zoom()
@@ -885,16 +638,59 @@ void pan()
   }
 }
 
+/* Rebuilds the camera's matrices, and the cursor to world mapping, if zoom
+ * or pan moved since the last frame or the window was resized */
+void updateCamera ()
+{
+  if (cam.valid && cam.zoom == zoomFactor && cam.pan == panFactor)
+    return;
+  cam.zoom = zoomFactor;
+  cam.pan = panFactor;
+  cam.valid = true;
+
+  cam.left = -40.0f/zoomFactor + panFactor;
+  cam.right = 40.0f/zoomFactor + panFactor;
+  cam.bottom = -40.0f/zoomFactor;
+  cam.top = 40.0f/zoomFactor;
+  cam.projection = glm::ortho(cam.left, cam.right, cam.bottom, cam.top, 0.1f, 500.0f);
+  // Eye, target and up never change; the view is only rebuilt alongside
+  cam.view = glm::lookAt(glm::vec3(0, 0, 1), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+  cam.VP = cam.projection * cam.view;
+
+  // the viewport fills the framebuffer, which on a HiDPI display has more
+  // pixels than the window has units; the cursor is in window units, so
+  // the window size maps it whatever the scale
+  float w = max(win_width, 1), h = max(win_height, 1);
+  cam.to_world[0] = (cam.right - cam.left) / w;
+  cam.to_world[1] = cam.left;
+  cam.to_world[2] = (cam.bottom - cam.top) / h;
+  cam.to_world[3] = cam.top;
+}
+
+/* The point of the world under the cursor, through the view on screen. All
+ * picking goes through here */
+void cursorWorld (GLFWwindow* window, double* x, double* y)
+{
+  double sx, sy;
+  glfwGetCursorPos(window, &sx, &sy);
+  updateCamera();
+  *x = sx*cam.to_world[0] + cam.to_world[1];
+  *y = sy*cam.to_world[2] + cam.to_world[3];
+}
+
 int mouse_basket = -1, mouse_shoot = -1, mouse_cannon = -1;
 double m_x,m_y;
+// a drag let go of, waiting for the next tick to move what it picked
+bool mouse_drop = false;
 
+/* Picks up a drag on press and notes where it is let go of; dropMouse()
+ * moves the basket or cannon on the next tick, so while paused a drop
+ * waits and no new drag starts */
 void mouse_movement (GLFWwindow* window)
 {
   if (mouse_basket == -1 && mouse_cannon == -1 && mouse_shoot == -1 && mouse_keystates_pressed[GLFW_MOUSE_BUTTON_LEFT] && !mouse_keystates_released[GLFW_MOUSE_BUTTON_LEFT])
   {
-    glfwGetCursorPos(window, &mouseX, &mouseY);
-    m_x = (mouseX*2*40/600) - 40.0;
-    m_y = 40.0 - (mouseY*2*40/600);
+    cursorWorld(window, &m_x, &m_y);
 
     for (int i=0; i<2; i++)
     {
@@ -906,7 +702,7 @@ void mouse_movement (GLFWwindow* window)
       }
     }
 
-    if (m_x >= -40 && m_x <= -39 + 8*cos(gun[0].rotate) && m_y >= gun[0].y - 5 && m_y <= gun[0].y + 5)
+    if (m_x >= -40 && m_x <= -39 + 8*gun[0].dx && m_y >= gun[0].y - 5 && m_y <= gun[0].y + 5)
     {
       m_y = gun[0].y;
       mouse_cannon = 1;
@@ -915,40 +711,47 @@ void mouse_movement (GLFWwindow* window)
     if (mouse_cannon == -1 && mouse_basket == -1)
       mouse_shoot = 1;
   }
-  else if (mouse_keystates_released[GLFW_MOUSE_BUTTON_LEFT])
+  else if (mouse_keystates_released[GLFW_MOUSE_BUTTON_LEFT] && !mouse_drop &&
+           (mouse_basket != -1 || mouse_cannon != -1 || mouse_shoot != -1))
   {
-    glfwGetCursorPos(window, &mouseX, &mouseY);
-    mouseX = (mouseX*2*40/600) - 40.0;
-    mouseY = 40.0 - (mouseY*2*40/600);
+    cursorWorld(window, &mouseX, &mouseY);
+    mouse_drop = true;
+  }
+}
 
-    if (mouse_cannon != -1 && mouse_shoot == -1 && mouse_basket == -1)
-    {
-        gun[0].y = mouseY;
-        gun[1].y = mouseY;
-        gun[0].translate += mouseY - m_y;
-        gun[1].translate += mouseY - m_y;
-        mouse_cannon = -1;
-    }
+/* Applies a pending drop, as one tick's input */
+void dropMouse ()
+{
+  if (!mouse_drop)
+    return;
+  mouse_drop = false;
 
-    if (mouse_shoot != -1 && mouse_basket == -1 && mouse_cannon == -1)
-    {
-        float angle;
-        angle = atan((mouseY - gun[0].y)/(mouseX - gun[0].x));
-        gun[0].rotate = angle;
-        gun[1].rotate = angle;
-        mouse_shoot = -1;
-    }
+  if (mouse_cannon != -1 && mouse_shoot == -1 && mouse_basket == -1)
+  {
+      gun[0].y = mouseY;
+      gun[1].y = mouseY;
+      gun[0].translate += mouseY - m_y;
+      gun[1].translate += mouseY - m_y;
+      mouse_cannon = -1;
+  }
 
-    if (mouse_basket != -1)
+  if (mouse_shoot != -1 && mouse_basket == -1 && mouse_cannon == -1)
+  {
+      float angle;
+      angle = atan((mouseY - gun[0].y)/(mouseX - gun[0].x));
+      aimCannon(angle);
+      mouse_shoot = -1;
+  }
+
+  if (mouse_basket != -1)
+  {
+    if (mouseX <= 38 && mouseX >= -38 && mouseY <= -36 && mouseY >= -40)
     {
-      if (mouseX <= 38 && mouseX >= -38 && mouseY <= -36 && mouseY >= -40)
-      {
-        bucket[mouse_basket].x1 = mouseX - 5.5;
-        bucket[mouse_basket].x2 = mouseX + 5.5;       
-        bucket[mouse_basket].translate += mouseX - m_x;
-      }
-      mouse_basket = -1;
+      bucket[mouse_basket].x1 = mouseX - 5.5;
+      bucket[mouse_basket].x2 = mouseX + 5.5;       
+      bucket[mouse_basket].translate += mouseX - m_x;
     }
+    mouse_basket = -1;
   }
 }
 
@@ -974,7 +777,440 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     panFactor = 0;
 }
 
-double last_update_time = glfwGetTime(), current_time;
+/* 2D affine transform: x' = a*x + c*y + tx, y' = b*x + d*y + ty. Every model
+ * in the scene is one of these, so composing it with the camera costs a
+ * dozen multiplies instead of a 4x4 product */
+struct affine2 {
+  float a, b, c, d, tx, ty;
+};
+
+affine2 translation (float x, float y)
+{
+  affine2 m = { 1, 0, 0, 1, x, y };
+  return m;
+}
+
+/* Lays a unit +x object from (x, y) along the unit vector (ux, uy) for len
+ * units; the columns are the direction and its normal, no trig needed */
+affine2 segmentModel (float x, float y, float ux, float uy, float len)
+{
+  affine2 m = { ux*len, uy*len, -uy, ux, x, y };
+  return m;
+}
+
+/* Objects submitted and skipped by the last draw() */
+int drawn_objects, culled_objects;
+
+/* Whether vao, placed by m, can cover any of the view: its box is carried
+ * through m as a centre and half extents, which gives the box around the
+ * placed box */
+bool inView (const VAO* vao, const affine2& m)
+{
+  float cx = (vao->MinX + vao->MaxX) / 2, cy = (vao->MinY + vao->MaxY) / 2;
+  float ex = (vao->MaxX - vao->MinX) / 2, ey = (vao->MaxY - vao->MinY) / 2;
+  float x = m.a*cx + m.c*cy + m.tx;
+  float y = m.b*cx + m.d*cy + m.ty;
+  float hx = fabs(m.a)*ex + fabs(m.c)*ey;
+  float hy = fabs(m.b)*ex + fabs(m.d)*ey;
+  bool in = x + hx >= cam.left && x - hx <= cam.right && y + hy >= cam.bottom && y - hy <= cam.top;
+  if (in)
+    drawn_objects++;
+  else
+    culled_objects++;
+  return in;
+}
+
+/* Uploads VP * m as the MVP uniform. m leaves z and w alone, so only the
+ * x, y and translation columns of VP are combined */
+void setModel (const affine2& m)
+{
+  const glm::mat4& vp = cam.VP;
+  GLfloat mvp[16];
+  for (int r=0;r<4;r++)
+  {
+    mvp[r] = vp[0][r]*m.a + vp[1][r]*m.b;
+    mvp[4 + r] = vp[0][r]*m.c + vp[1][r]*m.d;
+    mvp[8 + r] = vp[2][r];
+    mvp[12 + r] = vp[0][r]*m.tx + vp[1][r]*m.ty + vp[3][r];
+  }
+  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, mvp);
+}
+
+/* Draws vao placed by m, unless it is out of view */
+void drawModel (VAO* vao, const affine2& m)
+{
+  if (!inView(vao, m))
+    return;
+  setModel(m);
+  draw3DObject(vao);
+}
+
+/* Debris from shot bricks, all of it one GL_POINTS draw. The pool's arrays
+ * are copied into one buffer as they are, x, y, life and colour one after
+ * another, each attribute reading its own array */
+particle_pool debris;
+int debris_per_hit = DEBRIS_PER_HIT;
+
+struct particle_renderer {
+  GLuint program, mvp_id, size_id, fade_id;
+  GLuint vao, vbo;
+} sparks;
+
+#define PARTICLE_BUFFER_BYTES ((size_t)MAX_PARTICLES*(3*sizeof(GLfloat) + 1))
+
+void shatter (const rect& brick)
+{
+  emitDebris(&debris, brick, debris_per_hit);
+}
+
+void locateParticleUniforms ()
+{
+  sparks.mvp_id = glGetUniformLocation(sparks.program, "MVP");
+  sparks.size_id = glGetUniformLocation(sparks.program, "PointSize");
+  sparks.fade_id = glGetUniformLocation(sparks.program, "FadeTicks");
+}
+
+void createParticles ()
+{
+  sparks.program = LoadShaders("Particle_GL.vert", "Particle_GL.frag");
+  locateParticleUniforms();
+
+  glGenVertexArrays(1, &sparks.vao);
+  glBindVertexArray(sparks.vao);
+  glGenBuffers(1, &sparks.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, sparks.vbo);
+  glBufferData(GL_ARRAY_BUFFER, PARTICLE_BUFFER_BYTES, NULL, GL_STREAM_DRAW);
+  for (int a=0;a<3;a++)
+  {
+    glEnableVertexAttribArray(a);
+    glVertexAttribPointer(a, 1, GL_FLOAT, GL_FALSE, 0, (void*)(a*MAX_PARTICLES*sizeof(GLfloat)));
+  }
+  glEnableVertexAttribArray(3);
+  glVertexAttribIPointer(3, 1, GL_UNSIGNED_BYTE, 0, (void*)(3*MAX_PARTICLES*sizeof(GLfloat)));
+  gl_live.vaos++;
+  gl_live.buffers++;
+  gl_live.buffer_bytes += PARTICLE_BUFFER_BYTES;
+
+  // the vertex shader sets the size of each point
+  glEnable(GL_PROGRAM_POINT_SIZE);
+}
+
+void destroyParticles ()
+{
+  glDeleteBuffers(1, &sparks.vbo);
+  glDeleteVertexArrays(1, &sparks.vao);
+  glDeleteProgram(sparks.program);
+  gl_live.vaos--;
+  gl_live.buffers--;
+  gl_live.buffer_bytes -= PARTICLE_BUFFER_BYTES;
+}
+
+void drawParticles ()
+{
+  int n = debris.count;
+  if (n == 0)
+    return;
+  TRACE_SCOPE("particles_draw");
+  glBindBuffer(GL_ARRAY_BUFFER, sparks.vbo);
+  // orphan last frame's storage so the upload does not wait for its draw
+  glBufferData(GL_ARRAY_BUFFER, PARTICLE_BUFFER_BYTES, NULL, GL_STREAM_DRAW);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, n*sizeof(GLfloat), debris.x);
+  glBufferSubData(GL_ARRAY_BUFFER, MAX_PARTICLES*sizeof(GLfloat), n*sizeof(GLfloat), debris.y);
+  glBufferSubData(GL_ARRAY_BUFFER, 2*MAX_PARTICLES*sizeof(GLfloat), n*sizeof(GLfloat), debris.life);
+  glBufferSubData(GL_ARRAY_BUFFER, 3*MAX_PARTICLES*sizeof(GLfloat), n, debris.c);
+
+  glUseProgram(sparks.program);
+  glUniformMatrix4fv(sparks.mvp_id, 1, GL_FALSE, &cam.VP[0][0]);
+  glUniform1f(sparks.size_id, max(2, fb_height / 300));
+  glUniform1f(sparks.fade_id, DEBRIS_LIFE / 3);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glBindVertexArray(sparks.vao);
+  glDrawArrays(GL_POINTS, 0, n);
+  glDisable(GL_BLEND);
+  TRACE_COUNTER("particles", n);
+}
+
+/* What the end of the game says about a score */
+const char* verdict (int points)
+{
+  if (points <= 0)
+    return "Be more careful next time";
+  else if (points <= 100)
+    return "Not bad, try harder next time";
+  else if (points <= 200)
+    return "Well done. Good job";
+  else if (points <= 300)
+    return "You're a good player already";
+  else if (points <= 400)
+    return "Great score! Cheers";
+  else if (points <= 500)
+    return "Whohoho! Amazing game";
+  return "You're a legend!";
+}
+
+/* Heads-up display: score, lasers left, the time scale, the latest event and
+ * game over, as text over the scene. Every glyph is a cell of one prebaked
+ * atlas texture, and all the text is one vertex buffer drawn with a single
+ * call; the buffer is only refilled when something it shows changed, so most
+ * frames the HUD costs one glDrawArrays */
+#define HUD_MAX_CHARS 512
+/* Ticks an event stays on screen */
+#define HUD_EVENT_TICKS (2*TICK_RATE)
+/* Glyphs are 5x7 in an 8x8 cell; a character takes 6x8 including the gaps */
+#define GLYPH_CELL 8
+#define GLYPH_ADVANCE 6
+#define ATLAS_COLUMNS 16
+#define ATLAS_ROWS 4
+
+/* ' ' to '_', one row of 5 bits per line, the leftmost pixel in bit 4.
+ * Lower case is drawn as upper case, anything else as '?' */
+static const unsigned char font5x7[64][7] = {
+  {0x00,0x00,0x00,0x00,0x00,0x00,0x00}, {0x04,0x04,0x04,0x04,0x04,0x00,0x04},  //   !
+  {0x0A,0x0A,0x0A,0x00,0x00,0x00,0x00}, {0x0A,0x0A,0x1F,0x0A,0x1F,0x0A,0x0A},  // " #
+  {0x04,0x0F,0x14,0x0E,0x05,0x1E,0x04}, {0x18,0x19,0x02,0x04,0x08,0x13,0x03},  // $ %
+  {0x0C,0x12,0x14,0x08,0x15,0x12,0x0D}, {0x0C,0x04,0x08,0x00,0x00,0x00,0x00},  // & '
+  {0x02,0x04,0x08,0x08,0x08,0x04,0x02}, {0x08,0x04,0x02,0x02,0x02,0x04,0x08},  // ( )
+  {0x00,0x04,0x15,0x0E,0x15,0x04,0x00}, {0x00,0x04,0x04,0x1F,0x04,0x04,0x00},  // * +
+  {0x00,0x00,0x00,0x00,0x0C,0x04,0x08}, {0x00,0x00,0x00,0x1F,0x00,0x00,0x00},  // , -
+  {0x00,0x00,0x00,0x00,0x00,0x0C,0x0C}, {0x00,0x01,0x02,0x04,0x08,0x10,0x00},  // . /
+  {0x0E,0x11,0x13,0x15,0x19,0x11,0x0E}, {0x04,0x0C,0x04,0x04,0x04,0x04,0x0E},  // 0 1
+  {0x0E,0x11,0x01,0x02,0x04,0x08,0x1F}, {0x1F,0x02,0x04,0x02,0x01,0x11,0x0E},  // 2 3
+  {0x02,0x06,0x0A,0x12,0x1F,0x02,0x02}, {0x1F,0x10,0x1E,0x01,0x01,0x11,0x0E},  // 4 5
+  {0x06,0x08,0x10,0x1E,0x11,0x11,0x0E}, {0x1F,0x01,0x02,0x04,0x08,0x08,0x08},  // 6 7
+  {0x0E,0x11,0x11,0x0E,0x11,0x11,0x0E}, {0x0E,0x11,0x11,0x0F,0x01,0x02,0x0C},  // 8 9
+  {0x00,0x0C,0x0C,0x00,0x0C,0x0C,0x00}, {0x00,0x0C,0x0C,0x00,0x0C,0x04,0x08},  // : ;
+  {0x02,0x04,0x08,0x10,0x08,0x04,0x02}, {0x00,0x00,0x1F,0x00,0x1F,0x00,0x00},  // < =
+  {0x08,0x04,0x02,0x01,0x02,0x04,0x08}, {0x0E,0x11,0x01,0x02,0x04,0x00,0x04},  // > ?
+  {0x0E,0x11,0x01,0x0D,0x15,0x15,0x0E}, {0x0E,0x11,0x11,0x11,0x1F,0x11,0x11},  // @ A
+  {0x1E,0x11,0x11,0x1E,0x11,0x11,0x1E}, {0x0E,0x11,0x10,0x10,0x10,0x11,0x0E},  // B C
+  {0x1C,0x12,0x11,0x11,0x11,0x12,0x1C}, {0x1F,0x10,0x10,0x1E,0x10,0x10,0x1F},  // D E
+  {0x1F,0x10,0x10,0x1E,0x10,0x10,0x10}, {0x0E,0x11,0x10,0x17,0x11,0x11,0x0F},  // F G
+  {0x11,0x11,0x11,0x1F,0x11,0x11,0x11}, {0x0E,0x04,0x04,0x04,0x04,0x04,0x0E},  // H I
+  {0x07,0x02,0x02,0x02,0x02,0x12,0x0C}, {0x11,0x12,0x14,0x18,0x14,0x12,0x11},  // J K
+  {0x10,0x10,0x10,0x10,0x10,0x10,0x1F}, {0x11,0x1B,0x15,0x15,0x11,0x11,0x11},  // L M
+  {0x11,0x11,0x19,0x15,0x13,0x11,0x11}, {0x0E,0x11,0x11,0x11,0x11,0x11,0x0E},  // N O
+  {0x1E,0x11,0x11,0x1E,0x10,0x10,0x10}, {0x0E,0x11,0x11,0x11,0x15,0x12,0x0D},  // P Q
+  {0x1E,0x11,0x11,0x1E,0x14,0x12,0x11}, {0x0F,0x10,0x10,0x0E,0x01,0x01,0x1E},  // R S
+  {0x1F,0x04,0x04,0x04,0x04,0x04,0x04}, {0x11,0x11,0x11,0x11,0x11,0x11,0x0E},  // T U
+  {0x11,0x11,0x11,0x11,0x11,0x0A,0x04}, {0x11,0x11,0x11,0x15,0x15,0x15,0x0A},  // V W
+  {0x11,0x11,0x0A,0x04,0x0A,0x11,0x11}, {0x11,0x11,0x11,0x0A,0x04,0x04,0x04},  // X Y
+  {0x1F,0x01,0x02,0x04,0x08,0x10,0x1F}, {0x0E,0x08,0x08,0x08,0x08,0x08,0x0E},  // Z [
+  {0x00,0x10,0x08,0x04,0x02,0x01,0x00}, {0x0E,0x02,0x02,0x02,0x02,0x02,0x0E},  // \ ]
+  {0x04,0x0A,0x11,0x00,0x00,0x00,0x00}, {0x00,0x00,0x00,0x00,0x00,0x00,0x1F},  // ^ _
+};
+
+struct hud_vertex {
+  GLfloat x, y;  // framebuffer pixels from the top left
+  GLfloat u, v;
+  GLfloat r, g, b;
+};
+
+/* Everything the HUD shows; the text is rebuilt when this changes */
+struct hud_key {
+  int points;
+  int lasers;
+  int gameover;
+  int paused;
+  int scale;
+  const char* event;  // NULL once it has been up HUD_EVENT_TICKS
+  int width, height;
+};
+
+struct hud_renderer {
+  GLuint program, screen_id, atlas_id;
+  GLuint texture, vao, vbo;
+  int vertices;
+  bool valid;
+  hud_key built;
+  long rebuilds;
+} hud;
+
+hud_key hudKey ()
+{
+  hud_key k;
+  memset(&k, 0, sizeof(k));  // compared with memcmp, padding included
+  k.points = points;
+  k.lasers = max(LASER_LIMIT - hit_count, 0);
+  // over the network the game is only over once the peer's keys confirm it
+  k.gameover = gameover && (!net_active || netSettled());
+  k.paused = timectl.paused;
+  k.scale = timectl.scale;
+  if (game_event != NULL && tick - game_event_tick < HUD_EVENT_TICKS)
+    k.event = game_event;
+  k.width = fb_width;
+  k.height = fb_height;
+  return k;
+}
+
+/* Glyph size in pixels: 7 pixel high text grows with the window, by whole
+ * pixels so it stays sharp */
+static int hudPixel ()
+{
+  return max(2, fb_height / 200);
+}
+
+static float textWidth (const char* s)
+{
+  return strlen(s) * GLYPH_ADVANCE * hudPixel();
+}
+
+/* Appends two triangles per character of s, from (x, y) at the top left */
+static hud_vertex* hudText (hud_vertex* v, hud_vertex* end, const char* s, float x, float y, float r, float g, float b)
+{
+  int px = hudPixel();
+  float w = GLYPH_ADVANCE * px, h = GLYPH_CELL * px;
+  for (; *s && v + 6 <= end; s++, x += w)
+  {
+    int c = toupper((unsigned char)*s);
+    if (c == ' ')
+      continue;
+    if (c < ' ' || c > '_')
+      c = '?';
+    int cell = c - ' ';
+    float u0 = (float)(cell % ATLAS_COLUMNS) / ATLAS_COLUMNS;
+    float v0 = (float)(cell / ATLAS_COLUMNS) / ATLAS_ROWS;
+    float u1 = u0 + (float)GLYPH_ADVANCE / (ATLAS_COLUMNS*GLYPH_CELL);
+    float v1 = v0 + 1.0f / ATLAS_ROWS;
+    hud_vertex quad[4] = { { x, y, u0, v0, r, g, b }, { x + w, y, u1, v0, r, g, b },
+                           { x, y + h, u0, v1, r, g, b }, { x + w, y + h, u1, v1, r, g, b } };
+    *v++ = quad[0]; *v++ = quad[1]; *v++ = quad[2];
+    *v++ = quad[2]; *v++ = quad[1]; *v++ = quad[3];
+  }
+  return v;
+}
+
+/* Lays out the text for k into the frame arena and uploads it */
+void buildHud (const hud_key& k)
+{
+  TRACE_SCOPE("hud_build");
+  hud_vertex* start = arenaArray<hud_vertex>(&frame, 6*HUD_MAX_CHARS);
+  hud_vertex* end = start + 6*HUD_MAX_CHARS;
+  hud_vertex* v = start;
+  int px = hudPixel();
+  float margin = 3*px, line = 10*px;
+  char text[64];
+
+  snprintf(text, sizeof(text), "Score %d", k.points);
+  v = hudText(v, end, text, margin, margin, 0, 0, 0);
+  snprintf(text, sizeof(text), "Lasers %d", k.lasers);
+  // red for the last hundred
+  v = hudText(v, end, text, margin, margin + line, k.lasers <= 100 ? 0.8f : 0, 0, 0);
+
+  if (k.paused)
+    snprintf(text, sizeof(text), "Paused");
+  else if (k.scale < NORMAL_SPEED)
+    snprintf(text, sizeof(text), "Slow x1/%g", 1/time_scales[k.scale]);
+  else if (k.scale > NORMAL_SPEED)
+    snprintf(text, sizeof(text), "Fast x%g", time_scales[k.scale]);
+  else
+    text[0] = '\0';
+  v = hudText(v, end, text, k.width - margin - textWidth(text), margin, 0, 0, 0.6f);
+
+  if (k.event != NULL)
+    v = hudText(v, end, k.event, (k.width - textWidth(k.event)) / 2, margin + 2*line, 0.2f, 0.2f, 0.2f);
+
+  if (k.gameover)
+  {
+    const char* lines[] = { "Game over", verdict(k.points), "Press Q to quit" };
+    float y = k.height/2 - 2*line;
+    for (int i=0;i<3;i++, y += 1.5f*line)
+      v = hudText(v, end, lines[i], (k.width - textWidth(lines[i])) / 2, y, i == 0 ? 0.8f : 0, 0, 0);
+  }
+
+  hud.vertices = v - start;
+  glBindBuffer(GL_ARRAY_BUFFER, hud.vbo);
+  glBufferSubData(GL_ARRAY_BUFFER, 0, hud.vertices*sizeof(hud_vertex), start);
+  hud.built = k;
+  hud.valid = true;
+  hud.rebuilds++;
+}
+
+void locateHudUniforms ()
+{
+  hud.screen_id = glGetUniformLocation(hud.program, "Screen");
+  hud.atlas_id = glGetUniformLocation(hud.program, "Atlas");
+}
+
+/* Bakes font5x7 into the atlas, and sets up the program and the vertex buffer */
+void createHud ()
+{
+  int w = ATLAS_COLUMNS*GLYPH_CELL, h = ATLAS_ROWS*GLYPH_CELL;
+  unsigned char* pixels = arenaArray<unsigned char>(&frame, w*h);
+  memset(pixels, 0, w*h);
+  for (int c=0;c<64;c++)
+    for (int row=0;row<7;row++)
+      for (int col=0;col<5;col++)
+        if (font5x7[c][row] & (0x10 >> col))
+          pixels[((c / ATLAS_COLUMNS)*GLYPH_CELL + row)*w + (c % ATLAS_COLUMNS)*GLYPH_CELL + col] = 255;
+
+  glGenTextures(1, &hud.texture);
+  glBindTexture(GL_TEXTURE_2D, hud.texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, w, h, 0, GL_RED, GL_UNSIGNED_BYTE, pixels);
+  // whole pixels per texel: nearest keeps the edges hard
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  gl_live.textures++;
+
+  hud.program = LoadShaders("Text_GL.vert", "Text_GL.frag");
+  locateHudUniforms();
+
+  glGenVertexArrays(1, &hud.vao);
+  glBindVertexArray(hud.vao);
+  glGenBuffers(1, &hud.vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, hud.vbo);
+  glBufferData(GL_ARRAY_BUFFER, 6*HUD_MAX_CHARS*sizeof(hud_vertex), NULL, GL_DYNAMIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(hud_vertex), (void*)offsetof(hud_vertex, x));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(hud_vertex), (void*)offsetof(hud_vertex, u));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(hud_vertex), (void*)offsetof(hud_vertex, r));
+  gl_live.vaos++;
+  gl_live.buffers++;
+  gl_live.buffer_bytes += 6*HUD_MAX_CHARS*sizeof(hud_vertex);
+  hud.valid = false;
+}
+
+void destroyHud ()
+{
+  glDeleteTextures(1, &hud.texture);
+  glDeleteBuffers(1, &hud.vbo);
+  glDeleteVertexArrays(1, &hud.vao);
+  glDeleteProgram(hud.program);
+  gl_live.textures--;
+  gl_live.vaos--;
+  gl_live.buffers--;
+  gl_live.buffer_bytes -= 6*HUD_MAX_CHARS*sizeof(hud_vertex);
+}
+
+/* Over whatever draw() left: no depth test, glyphs blended on */
+void drawHud ()
+{
+  TRACE_SCOPE("hud");
+  hud_key k = hudKey();
+  if (!hud.valid || memcmp(&k, &hud.built, sizeof(k)) != 0)
+    buildHud(k);
+  if (hud.vertices == 0)
+    return;
+
+  glUseProgram(hud.program);
+  glUniform2f(hud.screen_id, fb_width, fb_height);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, hud.texture);
+  glUniform1i(hud.atlas_id, 0);
+  glDisable(GL_DEPTH_TEST);
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+  glBindVertexArray(hud.vao);
+  glDrawArrays(GL_TRIANGLES, 0, hud.vertices);
+  glDisable(GL_BLEND);
+  glEnable(GL_DEPTH_TEST);
+}
 
 /* Render the scene with openGL */
 /* Edit this function according to your assignment */
@@ -987,181 +1223,124 @@ void draw ()
   // Don't change unless you know what you are doing
   glUseProgram (programID);
 
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye (0, 0, 1);
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
-
-  Matrices.projection = glm::ortho(-40.0f/zoomFactor + panFactor, 40.0f/zoomFactor + panFactor, -40.0f/zoomFactor, 40.0f/zoomFactor, 0.1f, 500.0f);
-  // Compute Camera matrix (view)
-  Matrices.view = glm::lookAt( eye, target, up ); // Rotating Camera for 3D
-  //  Don't change unless you are sure!!
-  //Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-
-  // Compute ViewProject matrix as view/camera might not be changed for this frame (basic scenario)
-  //  Don't change unless you are sure!!
-  glm::mat4 VP = Matrices.projection * Matrices.view;
+  updateCamera ();
+  drawn_objects = culled_objects = 0;
 
-  // Send our transformation to the currently bound shader, in the "MVP" uniform
-  // For each model you render, since the MVP will be different (at least the M part)
-  //  Don't change unless you are sure!!
-  glm::mat4 MVP;	// MVP = Projection * View * Model
+  // only what is inside the view reaches draw3DObject: bricks waiting above
+  // the top edge, and anything zoomed or panned out of sight, are skipped
+  for (int i=0;i<num_boxes;i++)
+    if (boxes[i].alive)
+      // a brick falls in a straight line, so where it is between ticks is exact
+      drawModel(brick[boxes[i].c], translation(boxes[i].x1, boxes[i].y1 - speed*tick_alpha));
 
-  // Load identity to model matrix
-  Matrices.model = glm::mat4(1.0f);
+  drawModel(basket1, translation(bucket[0].translate, 0));
+  drawModel(basket2, translation(bucket[1].translate, 0));
+  drawModel(line, translation(0, 0));
 
-  /* Render your scene */
+  for (int i=0;i<num_mirrors;i++)
+  {
+    float dx = mirror[i].x2 - mirror[i].x1;
+    float dy = mirror[i].y2 - mirror[i].y1;
+    drawModel(reflector, segmentModel(mirror[i].x1, mirror[i].y1, mirror[i].ux, mirror[i].uy, sqrt(dx*dx + dy*dy)));
+  }
 
-  // //  Don't change unless you are sure!!
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  affine2 body = translation(0, gun[0].translate);
+  drawModel(cannon_t1, body);
+  drawModel(cannon_t2, body);
 
-  // Pop matrix to undo transformations till last push matrix instead of recomputing model matrix
-  // glPopMatrix ();
+  // rotate the barrel about (x, y), then slide it along its own up axis by translate
+  float cx = gun[0].dx, cy = gun[0].dy;
+  affine2 barrel = { cx, cy, -cy, cx,
+                     gun[0].x - (cx*gun[0].x - cy*gun[0].y) - gun[0].translate*cy,
+                     gun[0].y - (cy*gun[0].x + cx*gun[0].y) + gun[0].translate*cx };
+  drawModel(cannon_r1, barrel);
+  drawModel(cannon_r2, barrel);
 
-  for (int i=0;i<15;i++)
+  // beams are switched off by their timer once BEAM_LIFETIME ticks have passed
+  for (int i=0;i<beams;i++)
   {
-    // glTranslatef
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translateRectangle = glm::translate (glm::vec3(0, boxes[i].translation, 0));
-    Matrices.model *= translateRectangle;
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  	boxes[i].y1 -= speed;
-  	boxes[i].y2 -= speed;
-    boxes[i].translation -= speed;
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(rectangle[i]);
+    float dx = bullet[i].x2 - bullet[i].x1;
+    float dy = bullet[i].y2 - bullet[i].y1;
+    drawModel(beam, segmentModel(bullet[i].x1, bullet[i].y1, bullet[i].dx, bullet[i].dy, sqrt(dx*dx + dy*dy)));
   }
+  TRACE_COUNTER("drawn", drawn_objects);
+  TRACE_COUNTER("culled", culled_objects);
 
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateBasket1 = glm::translate (glm::vec3(bucket[0].translate, 0, 0));
-  Matrices.model *= translateBasket1;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(basket1);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateBasket2 = glm::translate (glm::vec3(bucket[1].translate, 0, 0));
-  Matrices.model *= translateBasket2;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  draw3DObject(basket2);
-
-  Matrices.model = glm::mat4(1.0f);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  draw3DObject(line);
-  draw3DObject(mirror1);  
-  draw3DObject(mirror2);
-  draw3DObject(mirror3);
-  
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateCannonTriangles = glm::translate (glm::vec3(0, gun[0].translate, 0));
-  Matrices.model *= translateCannonTriangles;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(cannon_t1);
-  draw3DObject(cannon_t2);
-
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateCannons = glm::translate (glm::vec3(0 - gun[0].translate*sin(gun[0].rotate), gun[0].translate*cos(gun[0].rotate), 0));
-  glm::mat4 translateCannons_to_origin = glm::translate (glm::vec3(-1*gun[0].x,-1*gun[0].y, 0));    
-  glm::mat4 rotateCannons = glm::rotate((float)(gun[0].rotate), glm::vec3(0,0,1));  // rotate about vector (1,0,0)
-  glm::mat4 translateCannons_back = glm::translate (glm::vec3(gun[0].x, gun[0].y, 0));
-  glm::mat4 cannonTransform =  translateCannons * translateCannons_back * rotateCannons * translateCannons_to_origin;
-  Matrices.model *= cannonTransform;
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  draw3DObject(cannon_r1);
-  draw3DObject(cannon_r2);
-
-  Matrices.model = glm::mat4(1.0f);
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-  current_time = glfwGetTime();
-  int hit = -1;
-  if ((current_time - last_update_time) >= 1)
-  {  
-	  // atleast 0.5s elapsed since last frame
-	  if (keystates_pressed[GLFW_KEY_SPACE])
-	  {
-    	// do something every 0.5 seconds ..
-		  float x1,x2,y1,y2,x,y,m1,m2,c1,c2;
-		  int flag = 0, count = 0, j;
-		  bool check[3] = {false,false,false};
-
-		  m1 = gun[1].rotate;
-		  x1 = gun[0].x + (gun[1].x - gun[0].x)*cos(m1);
-		  y1 = gun[1].y + (gun[1].x - gun[0].x)*sin(m1);
-
-	  	while (flag == 0)
-	  	{
-        for (int i=0;i<3;i++)
-        {
-          if (check[i] == false)
-          {
-            c1 = y1 - tan(m1)*x1;
-            m2 = mirror[i].m;
-            c2 = mirror[i].c;
-
-            x2 = (c2-c1)/(tan(m1)-tan(m2));
-            y2 = tan(m1)*x2 + c1;
-
-            if (x2 > mirror[i].x1 && x2 < mirror[i].x2)
-            {
-              check[i] = true;
-              createLaser (x1,y1,x2,y2,m1,c1,count);
-              m1 = 2*m2 - m1;
-              x1 = x2;
-              y1 = y2;
-              c1 = y2 - tan(m1)*x2;
-              count++;
-            }
-            else if (count > 0)
-            {
-              createLaser (x1,y1,0,0,m1,c1,count);    
-              flag = 1;
-              break;            
-            }
-          }
-        }
-	  		if (count == 0 && flag == 0)
-	  		{
-		        createLaser (x1,y1,0,0,m1,c1,count);
-		        flag = 1;		
-	  		}
-      }
-	  }
-    last_update_time = current_time;
-  }
+  drawParticles();
+  drawHud();
+}
 
-  current_time = glfwGetTime();
-  if (current_time - last_update_time < 0.2)
-  {
-      for (int i=0;i<10;i++)
-      {
-        if (laser[i] != NULL)
-        {
-          shoot(i);
-          draw3DObject(laser[i]);
-        }
-        else
-         break;
-      }
-  }
-  else
+/* What the last presented frame showed. A frame with the same key, and no
+ * brick falling since, would draw the same pixels, so it is skipped */
+struct scene_key {
+  int alive;
+  unsigned int serials;  // moves on whenever a brick respawns
+  int beams;
+  float beam_end[2];     // where a hit cut the beam short
+  float gun_y;
+  float gun_rotate;
+  float basket[2];
+  float zoom;
+  float pan;
+  int particles;
+  hud_key hud;
+};
+
+scene_key presented;
+
+/* GLFW asks for this when the window was uncovered or damaged */
+void refreshWindow (GLFWwindow* window)
+{
+  redraw = true;
+}
+
+scene_key sceneKey ()
+{
+  scene_key k;
+  memset(&k, 0, sizeof(k));  // compared with memcmp, padding included
+  for (int i=0;i<num_boxes;i++)
+    if (boxes[i].alive)
+    {
+      k.alive++;
+      k.serials += boxes[i].serial;
+    }
+  k.beams = beams;
+  if (beams > 0)
   {
-    for (int i=0;i<10;i++)
-      laser[i] = NULL;    
+    k.beam_end[0] = bullet[beams-1].x2;
+    k.beam_end[1] = bullet[beams-1].y2;
   }
+  k.gun_y = gun[0].y;
+  k.gun_rotate = gun[0].rotate;
+  k.basket[0] = bucket[0].translate;
+  k.basket[1] = bucket[1].translate;
+  k.zoom = zoomFactor;
+  k.pan = panFactor;
+  k.particles = debris.count;
+  k.hud = hudKey();
+  return k;
+}
 
+/* Whether this frame would differ from the one on screen; moving says live
+ * bricks moved, because ticks ran or the frame is further between two */
+bool sceneChanged (bool moving)
+{
+  scene_key k = sceneKey();
+  bool changed = redraw || (moving && (k.alive > 0 || k.particles > 0)) || memcmp(&k, &presented, sizeof(k)) != 0;
+  presented = k;
+  redraw = false;
+  return changed;
+}
+
+/* Longest sleep of a frame with nothing to draw and no tick to run */
+#define IDLE_WAIT 0.5
+/* Seconds of ticks a fast forwarded frame may run */
+#define FRAME_BUDGET 0.012
+
+/* Get a handle for our "MVP" uniform */
+void locateSceneUniforms ()
+{
+	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -1202,6 +1381,9 @@ GLFWwindow* initGLFW (int width, int height)
     /* Register function to handle window close */
     glfwSetWindowCloseCallback(window, quit);
 
+    /* Register function to repaint a damaged window, frames are only drawn on change */
+    glfwSetWindowRefreshCallback(window, refreshWindow);
+
     /* Register function to handle keyboard input */
     glfwSetKeyCallback(window, keyboard);      // general keyboard input
     glfwSetCharCallback(window, keyboardChar);  // simpler specific character handling
@@ -1222,17 +1404,16 @@ void initGL (GLFWwindow* window, int width, int height)
 
   createCannon ();
   createBasket ();
-
-  for (int i=0; i<15;i++)
-    createRectangle (i);
-
+  createBricks ();
+  createBeam ();
   createLine ();
-  createMirrors ();
+  createMirror ();
 
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	locateSceneUniforms ();
+	createParticles ();
+	createHud ();
 
 	reshapeWindow (window, width, height);
 
@@ -1249,13 +1430,277 @@ void initGL (GLFWwindow* window, int width, int height)
     cout << "GLSL: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << endl;
 }
 
+/* Everything initGL made, deleted while the context is still current */
+void destroyGL ()
+{
+  VAO** models[] = { &beam, &cannon_t1, &cannon_t2, &cannon_r1, &cannon_r2, &brick[0], &brick[1], &brick[2],
+                     &basket1, &basket2, &reflector, &line };
+  for (size_t i=0;i<sizeof(models)/sizeof(models[0]);i++)
+  {
+    destroy3DObject(*models[i]);
+    *models[i] = NULL;
+  }
+  destroyParticles();
+  destroyHud();
+  glDeleteProgram(programID);
+}
+
+/* One line of live memory: heap blocks and bytes, GL objects and buffer bytes */
+void printMemory (const char* when)
+{
+  heap_stats h = heapStats();
+  printf("memory %s: heap %llu blocks %llu bytes, GL %ld VAOs %ld buffers %lld bytes %ld textures\n", when,
+         (unsigned long long)(h.allocs - h.frees), (unsigned long long)h.live,
+         gl_live.vaos, gl_live.buffers, gl_live.buffer_bytes, gl_live.textures);
+}
+
+/* Programs the game draws with, and what looks up their uniforms once linked */
+struct shader_program {
+  const char* vert;
+  const char* frag;
+  GLuint* program;
+  void (*locate) ();
+};
+
+static const shader_program shaders[] = {
+  { "Sample_GL.vert", "Sample_GL.frag", &programID, locateSceneUniforms },
+  { "Text_GL.vert", "Text_GL.frag", &hud.program, locateHudUniforms },
+  { "Particle_GL.vert", "Particle_GL.frag", &sparks.program, locateParticleUniforms },
+};
+#define SHADERS (int)(sizeof(shaders)/sizeof(shaders[0]))
+
+/* Hot reload (--hot-reload). A thread waits on inotify for the shaders and
+ * the level file to be rewritten. It compiles and links changed shaders on a
+ * hidden context that shares objects with the window's, and maps and checks
+ * a changed level, so the frame loop never waits for either. What it made is
+ * handed over under the lock and swapped in by applyReloads() between two
+ * frames. A shader that does not build, or a level that does not load, keeps
+ * the old one */
+struct hot_reload {
+  bool active;
+  file_watch files;
+  unsigned shader_bits[SHADERS];  // watch bits of each program's two files
+  unsigned level_bit;
+  const char* level_path;
+  GLFWwindow* context;
+  frame_arena arena;  // the thread's, for shader sources and logs
+  thread worker;
+  mutex lock;
+  atomic<bool> pending;
+  GLuint ready[SHADERS];  // linked and finished, 0 for none
+  const level_file* level;
+} reload;
+
+static void reloadWorker ()
+{
+  glfwMakeContextCurrent(reload.context);
+  unsigned changed;
+  while ((changed = watchWait(&reload.files)) != 0)
+  {
+    for (int k=0;k<SHADERS;k++)
+    {
+      if (!(changed & reload.shader_bits[k]))
+        continue;
+      GLuint p = LoadShaders(shaders[k].vert, shaders[k].frag, &reload.arena);
+      if (p == 0)
+      {
+        printf("hot reload: %s and %s did not build, keeping the old program\n", shaders[k].vert, shaders[k].frag);
+        continue;
+      }
+      // complete before the window's context draws with it
+      glFinish();
+      lock_guard<mutex> guard(reload.lock);
+      if (reload.ready[k] != 0)
+        glDeleteProgram(reload.ready[k]);
+      reload.ready[k] = p;
+      reload.pending = true;
+    }
+    if (changed & reload.level_bit)
+    {
+      const level_file* l = mapLevel(reload.level_path);
+      if (l == NULL)
+        printf("hot reload: keeping the old %s\n", reload.level_path);
+      else
+      {
+        lock_guard<mutex> guard(reload.lock);
+        unmapLevel(reload.level);
+        reload.level = l;
+        reload.pending = true;
+      }
+    }
+    arenaReset(&reload.arena);
+  }
+  glfwMakeContextCurrent(NULL);
+}
+
+/* Watches the shaders, and the level unless levels must not change (a
+ * networked game). False, with a message, if it cannot */
+bool reloadStart (GLFWwindow* window, const char* level_path, bool watch_level)
+{
+  if (!watchOpen(&reload.files))
+    return false;
+  for (int k=0;k<SHADERS;k++)
+  {
+    int v = watchFile(&reload.files, shaders[k].vert), f = watchFile(&reload.files, shaders[k].frag);
+    reload.shader_bits[k] = (v >= 0 ? 1u << v : 0) | (f >= 0 ? 1u << f : 0);
+  }
+  if (watch_level)
+  {
+    int b = watchFile(&reload.files, level_path);
+    reload.level_bit = b >= 0 ? 1u << b : 0;
+  }
+  reload.level_path = level_path;
+
+  // same version and profile as the window, never shown
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  reload.context = glfwCreateWindow(1, 1, "reload", NULL, window);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+  if (reload.context == NULL)
+  {
+    fprintf(stderr, "hot reload: cannot create a shared GL context\n");
+    watchClose(&reload.files);
+    return false;
+  }
+  arenaInit(&reload.arena, 64*1024);
+  reload.pending = false;
+  reload.worker = thread(reloadWorker);
+  reload.active = true;
+  return true;
+}
+
+void reloadStop ()
+{
+  if (!reload.active)
+    return;
+  watchWake(&reload.files);
+  reload.worker.join();
+  glfwDestroyWindow(reload.context);
+  for (int k=0;k<SHADERS;k++)
+    if (reload.ready[k] != 0)
+      glDeleteProgram(reload.ready[k]);
+  unmapLevel(reload.level);
+  watchClose(&reload.files);
+  arenaFree(&reload.arena);
+  reload.active = false;
+}
+
+/* Takes in whatever the thread has finished, between two frames */
+void applyReloads ()
+{
+  if (!reload.pending)
+    return;
+  TRACE_SCOPE("reload");
+  lock_guard<mutex> guard(reload.lock);
+  reload.pending = false;
+  for (int k=0;k<SHADERS;k++)
+  {
+    if (reload.ready[k] == 0)
+      continue;
+    glDeleteProgram(*shaders[k].program);
+    *shaders[k].program = reload.ready[k];
+    reload.ready[k] = 0;
+    shaders[k].locate();
+    printf("hot reload: %s and %s are live\n", shaders[k].vert, shaders[k].frag);
+  }
+  if (reload.level != NULL)
+  {
+    // the planner's threads only run inside autopilotTick(), so nothing else reads the level now
+    const level_file* old = level;
+    swapLevel(reload.level);
+    reload.level = NULL;
+    VAO** meshes[] = { &cannon_t1, &cannon_t2, &cannon_r1, &cannon_r2, &basket1, &basket2, &brick[0], &brick[1], &brick[2] };
+    for (size_t i=0;i<sizeof(meshes)/sizeof(meshes[0]);i++)
+      destroy3DObject(*meshes[i]);
+    createCannon ();
+    createBasket ();
+    createBricks ();
+    unmapLevel(old);
+    printf("hot reload: %s is live\n", reload.level_path);
+  }
+  redraw = true;
+}
+
+/* Transient per frame data; the arena grows past this if a frame needs more */
+#define FRAME_ARENA_SIZE (256*1024)
+/* Frames in which buffers may still grow to their working size */
+#define WARMUP_FRAMES TICK_RATE
+/* Live memory is printed once a minute, so a long session shows it stays flat */
+#define MEMORY_REPORT_FRAMES (60*TICK_RATE)
+
 int main (int argc, char** argv)
 {
-  srand(time(NULL));
+  const char* trace_path = NULL;
+  const char* level_path = "classic.lvl";
+  const char* pattern_path = NULL;
+  int autopilot = -1;
+  unsigned int seed = time(NULL);
+  bool seeded = false;
+  int net_player = -1, net_port = 0, net_delay = NET_INPUT_DELAY;
+  const char* net_peer = NULL;
+  const char* spectate_addr = NULL;
+  bool hot_reload = false;
+  for (int i=1;i<argc;i++)
+  {
+    if (string(argv[i]) == "--trace" && i+1 < argc)
+      trace_path = argv[++i];
+    else if (string(argv[i]) == "--bounces" && i+1 < argc)
+      beam_limit = atoi(argv[++i]);
+    else if (string(argv[i]) == "--level" && i+1 < argc)
+      level_path = argv[++i];
+    else if (string(argv[i]) == "--pattern" && i+1 < argc)
+      pattern_path = argv[++i];
+    else if (string(argv[i]) == "--autopilot" && i+1 < argc)
+      autopilot = atoi(argv[++i]);
+    else if (string(argv[i]) == "--seed" && i+1 < argc)
+    {
+      seed = strtoul(argv[++i], NULL, 10);
+      seeded = true;
+    }
+    else if (string(argv[i]) == "--net" && i+3 < argc)
+    {
+      net_player = atoi(argv[++i]) ? 1 : 0;
+      net_port = atoi(argv[++i]);
+      net_peer = argv[++i];
+    }
+    else if (string(argv[i]) == "--net-delay" && i+1 < argc)
+      net_delay = atoi(argv[++i]);
+    else if (string(argv[i]) == "--spectate" && i+1 < argc)
+      spectate_addr = argv[++i];
+    else if (string(argv[i]) == "--debris" && i+1 < argc)
+      debris_per_hit = atoi(argv[++i]);
+    else if (string(argv[i]) == "--hot-reload")
+      hot_reload = true;
+  }
+  // both sides of a networked game must play the same bricks
+  if (net_peer != NULL && !seeded)
+    seed = 1;
+  if (net_peer != NULL && autopilot >= 0)
+  {
+    cerr<<"--autopilot changes the game directly and cannot play over --net"<<endl;
+    exit(EXIT_FAILURE);
+  }
+
+  // like the shaders, levels are loaded relative to the working directory
+  const level_file* l = mapLevel(level_path);
+  if (l == NULL)
+    exit(EXIT_FAILURE);
+  useLevel(l);
+
+  static spawn_pattern waves;
+  if (pattern_path != NULL)
+  {
+    if (!openPattern(&waves, pattern_path))
+      exit(EXIT_FAILURE);
+    usePattern(&waves);
+  }
+  if (trace_path != NULL)
+  {
+    trace_start();
+    trace_thread_name("main");
+  }
 
 	int width = 600;
 	int height = 600;
- 	int count = 0;
 
   for (int i=0;i<350;i++)
   {
@@ -1263,73 +1708,193 @@ int main (int argc, char** argv)
     keystates_released[i] = false;
   }
 
+  initGame (seed);
+  if (net_peer != NULL && !netStart (net_player, net_port, net_peer, net_delay))
+    exit(EXIT_FAILURE);
+  if (spectate_addr != NULL && !spectateStart (spectate_addr))
+    exit(EXIT_FAILURE);
+  // soak test: the planner plays, the keys still work on top of it
+  if (autopilot >= 0)
+    autopilotStart (autopilot);
+
+  // before initGL, which loads the shaders into it
+  arenaInit (&frame, FRAME_ARENA_SIZE);
+  if (!particlesInit (&debris))
+    exit(EXIT_FAILURE);
+  brick_shot_hook = shatter;
+
   GLFWwindow* window = initGLFW(width, height);
 
 	initGL (window, width, height);
+  // both sides of a networked game must keep playing the same level
+  if (hot_reload && !reloadStart (window, level_path, net_peer == NULL))
+    exit(EXIT_FAILURE);
 
     /* Draw in loop */
   
   cout<<"=========================================="<<endl;
   cout<<"Start playing, best of luck!"<<endl;
-  cout<<"Your score is 0"<<endl;
-
-  while (!glfwWindowShouldClose(window) && !gameover) {
-
-    mouse_movement (window);
-    translateBaskets ();
-    score ();
-    translateCannon ();
-    rotateCannon ();
-
-    for (int i=0;i<15;i++)
+  // the score, lasers and what just happened are on screen now
+  game_messages = false;
+
+  long frames = 0, steady_allocs = 0;
+  heap_stats heap = heapStats(), warm = heap;
+  long drawn_frames = 0, dropped_ticks = 0;
+  float drawn_alpha = 0;
+  // the game over screen stays up until Q; an autopilot soak test just ends
+  while (!glfwWindowShouldClose(window) && !(gameover && autopilot >= 0)) {
+    TRACE_SCOPE("frame");
+    double frame_start = glfwGetTime();
+    applyReloads ();
+
+    // a networked game changes only through netTick(); the view is still local
+    uint16_t keys[2] = { 0, 0 };
+    if (!net_active)
     {
-        if (boxes[i].y2 < -36.0 && boxes[i].alive == true)
-        {
-           count++;
-           boxes[i].alive = false;
-           createRectangle (i);
-           if (count == 15)
-           {
-              y = 0;
-              count = 0;
-           }
-        }
+      TRACE_SCOPE("input");
+      mouse_movement (window);
+      localKeys (keys);
     }
-
-    block_speed ();
     zoom();
     pan();
+    // paused, slow motion or fast forward: the keys, a mouse drop and the
+    // autopilot act once per tick, as does everything in the simulation
+    int due = ticksDue ();
+    int ran = 0;
+    {
+      TRACE_SCOPE("step");
+      for (; ran < due && !gameover; ran++)
+      {
+        // fast forward never holds up a frame for long; ticks that do not
+        // fit in FRAME_BUDGET are dropped rather than carried over
+        if (ran > 0 && glfwGetTime() - frame_start > FRAME_BUDGET)
+        {
+          dropped_ticks += due - ran;
+          break;
+        }
+        if (net_active)
+        {
+          // waiting for the peer: draw what we have, try again next frame
+          if (!netTick (netKeys ()))
+            break;
+          spectateTick ();
+          continue;
+        }
+        applyInput (0, keys[0]);
+        applyInput (1, keys[1]);
+        dropMouse ();
+        autopilotTick ();
+        snapshotTick ();
+        stepGame ();
+        spectateTick ();
+      }
+      // a late packet may still roll the game back while it waits
+      if (net_active && ran == 0)
+        netPoll ();
+    }
+    TRACE_COUNTER("ticks", ran);
+    updateParticles (&debris, ran);
 
-     // OpenGL Draw commands
-    draw();
+    // nothing changed on screen (no brick falling, nothing moved): skip the
+    // draw and the swap, and wait for input or the next tick instead
+    bool moving = ran > 0 || tick_alpha != drawn_alpha;
+    if (sceneChanged (moving))
+    {
+      drawn_alpha = tick_alpha;
+      {
+        TRACE_SCOPE("draw");
+         // OpenGL Draw commands
+        draw();
+      }
 
-      // Swap Frame Buffer in double buffering
-    glfwSwapBuffers(window);
+      {
+        TRACE_SCOPE("swap");
+          // Swap Frame Buffer in double buffering
+        glfwSwapBuffers(window);
+      }
+      drawn_frames++;
 
-      // Poll for Keyboard and mouse events
-    glfwPollEvents();
+        // Poll for Keyboard and mouse events
+      glfwPollEvents();
+    }
+    else
+    {
+      // same picture as last time: leave it on screen and sleep until the
+      // next tick is due, waking early only to handle input
+      TRACE_SCOPE("idle");
+      bool running = !timectl.paused;
+      double wake = frame_start + (running ? (1 - timectl.pending)
+          / (TICK_RATE * time_scales[timectl.scale]) : IDLE_WAIT);
+      do
+        glfwWaitEventsTimeout(max(wake - glfwGetTime(), 0.0));
+      while (running && glfwGetTime() < wake && !glfwWindowShouldClose(window));
+    }
+    TRACE_COUNTER("points", points);
+
+    // everything allocated for this frame goes at once; past the warm-up a
+    // frame should not have touched the heap at all
+    arenaReset (&frame);
+    heap_stats now = heapStats();
+    TRACE_COUNTER("heap_allocs", now.allocs - heap.allocs);
+    TRACE_COUNTER("heap_live_bytes", now.live);
+    TRACE_COUNTER("gl_buffer_bytes", gl_live.buffer_bytes);
+    if (++frames > WARMUP_FRAMES)
+      steady_allocs += now.allocs - heap.allocs;
+    else if (frames == WARMUP_FRAMES)
+      warm = now;
+    heap = now;
+    if (frames % MEMORY_REPORT_FRAMES == 0)
+      printMemory("in play");
 
         // Control based on time (Time based transformation like 5 degrees rotation every 0.5s)
     }
 
-    if (points <= 0)
-    	cout<<"Be more careful next time"<<endl;
-    else if (points <= 100 && points > 0)
-    	cout<<"Not bad, try harder next time"<<endl;
-    else if (points <= 200 && points > 100)
-    	cout<<"Well done. Good job"<<endl;
-    else if (points <= 300 && points > 200)
-    	cout<<"You're a good player already"<<endl;
-    else if (points <= 400 && points > 300)
-    	cout<<"Great score! Cheers"<<endl;
-    else if (points <= 500 && points > 400)
-    	cout<<"Whohoho! Amazing game"<<endl;
-    else if (points > 500)
-    	cout<<"You're a legend!"<<endl;
-
+    cout<<verdict(points)<<endl;
 	cout<<"=========================================="<<endl;
     cout<<"Your final score is "<<points<<endl;
 
+    printf("frames: %ld drawn, %ld skipped as unchanged\n", drawn_frames, frames - drawn_frames);
+    if (dropped_ticks > 0)
+      printf("fast forward: %ld ticks dropped to keep the frame rate\n", dropped_ticks);
+    if (debris.dropped > 0)
+      printf("debris: %ld of %ld particles cut for the %d budget\n", debris.dropped,
+             debris.emitted + debris.dropped, MAX_PARTICLES);
+    if (frames > WARMUP_FRAMES)
+      printf("heap: %ld allocations in %ld frames after warm-up, frame arena peak %lu bytes\n",
+             steady_allocs, frames - WARMUP_FRAMES, (unsigned long)frame.peak);
+
+    if (net_active)
+    {
+      if (!netSettle (1000))
+        printf("netplay: the peer did not answer at the end\n");
+      printf("netplay: %ld rollbacks replaying %ld ticks, %ld stalls, %ld desyncs in %ld sync checks\n",
+             net.rollbacks, net.replayed, net.stalls, net.desyncs, net.sync_checks);
+      netStop();
+    }
+    if (spectate_addr != NULL)
+    {
+      printf("spectate: %ld viewers, %ld dropped as too slow, %.1f MB sent\n",
+             spectators.accepted, spectators.dropped, spectators.bytes / 1e6);
+      spectateStop();
+    }
+    autopilotStop();
+    if (trace_path != NULL)
+      trace_write(trace_path);
+
+    // anything still alive after the teardown is a leak
+    reloadStop();
+    destroyGL();
+    brick_shot_hook = NULL;
+    particlesFree(&debris);
+    arenaFree(&frame);
+    printMemory("at exit");
+    if (gl_live.vaos != 0 || gl_live.buffers != 0 || gl_live.textures != 0)
+      printf("memory: %ld VAOs, %ld buffers and %ld textures were never deleted\n", gl_live.vaos, gl_live.buffers,
+             gl_live.textures);
+    if (frames > WARMUP_FRAMES)
+      printf("memory: heap grew by %lld bytes in play after warm-up\n", (long long)(heap.live - warm.live));
+
+    glfwDestroyWindow(window);
     glfwTerminate();
 //    exit(EXIT_SUCCESS);
 }
\ No newline at end of file
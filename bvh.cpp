@@ -0,0 +1,163 @@
+#include <cmath>
+#include <algorithm>
+
+#include "bvh.h"
+
+using namespace std;
+
+#define BVH_LEAF_SIZE 2
+#define BVH_STACK 64
+
+static float centre (const reflectors& r, int axis)
+{
+  return axis == 0 ? (r.x1 + r.x2) / 2 : (r.y1 + r.y2) / 2;
+}
+
+static void bvhBounds (bvh_node& node, const mirror_bvh* b, const reflectors* m)
+{
+  node.minx = node.miny = INFINITY;
+  node.maxx = node.maxy = -INFINITY;
+  for (int i=node.first; i<node.first+node.count; i++)
+  {
+    const reflectors& r = m[b->items[i]];
+    node.minx = min(node.minx, min(r.x1, r.x2));
+    node.maxx = max(node.maxx, max(r.x1, r.x2));
+    node.miny = min(node.miny, min(r.y1, r.y2));
+    node.maxy = max(node.maxy, max(r.y1, r.y2));
+  }
+}
+
+/* Splits at the median centre along the longer side of the node */
+static void bvhSplit (mirror_bvh* b, const reflectors* m, int idx)
+{
+  bvh_node& node = b->nodes[idx];
+  bvhBounds(node, b, m);
+  if (node.count <= BVH_LEAF_SIZE)
+    return;
+
+  int axis = (node.maxx - node.minx) >= (node.maxy - node.miny) ? 0 : 1;
+  int first = node.first, count = node.count, half = count / 2;
+  nth_element(b->items + first, b->items + first + half, b->items + first + count,
+              [m, axis](int a, int c) { return centre(m[a], axis) < centre(m[c], axis); });
+
+  int left = b->nodes_used;
+  b->nodes_used += 2;
+  b->nodes[left].first = first;
+  b->nodes[left].count = half;
+  b->nodes[left+1].first = first + half;
+  b->nodes[left+1].count = count - half;
+  node.first = left;
+  node.count = 0;
+
+  bvhSplit(b, m, left);
+  bvhSplit(b, m, left+1);
+}
+
+void bvhBuild (mirror_bvh* b, const reflectors* m, int n)
+{
+  for (int i=0; i<n; i++)
+    b->items[i] = i;
+  b->nodes_used = 1;
+  b->nodes[0].first = 0;
+  b->nodes[0].count = n;
+  bvhSplit(b, m, 0);
+}
+
+/* Entry distance of the ray into the box, or INFINITY if it misses before t_max */
+static float bvhEnter (const bvh_node& node, float ox, float oy, float ix, float iy, float t_max)
+{
+  float t0 = 0, t1 = t_max;
+
+  float a = (node.minx - ox) * ix, c = (node.maxx - ox) * ix;
+  if (isnan(a) || isnan(c))
+  {
+    // ray parallel to the slab and starting on its face
+    if (ox < node.minx || ox > node.maxx)
+      return INFINITY;
+  }
+  else
+  {
+    t0 = max(t0, min(a, c));
+    t1 = min(t1, max(a, c));
+  }
+
+  a = (node.miny - oy) * iy;
+  c = (node.maxy - oy) * iy;
+  if (isnan(a) || isnan(c))
+  {
+    if (oy < node.miny || oy > node.maxy)
+      return INFINITY;
+  }
+  else
+  {
+    t0 = max(t0, min(a, c));
+    t1 = min(t1, max(a, c));
+  }
+
+  return t0 <= t1 ? t0 : INFINITY;
+}
+
+/* Nearest mirror hit by the ray origin + t*(dx,dy), t > 0, ignoring mirror skip.
+ * Returns the mirror index and sets t_hit, or -1 */
+int bvhNearest (const mirror_bvh* b, const reflectors* m, float ox, float oy, float dx, float dy, int skip, float* t_hit)
+{
+  if (b->nodes[0].count == 0 && b->nodes_used == 1)
+    return -1;
+
+  float ix = 1 / dx, iy = 1 / dy;
+  float best = INFINITY;
+  int hit = -1;
+
+  int stack[BVH_STACK];
+  int top = 0;
+  stack[top++] = 0;
+
+  while (top > 0)
+  {
+    const bvh_node& node = b->nodes[stack[--top]];
+    if (bvhEnter(node, ox, oy, ix, iy, best) == INFINITY)
+      continue;
+
+    if (node.count > 0)
+    {
+      for (int k=node.first; k<node.first+node.count; k++)
+      {
+        int i = b->items[k];
+        if (i == skip)
+          continue;
+
+        // solve origin + t*d = mirror start + u*(mirror end - mirror start)
+        float ex = m[i].x2 - m[i].x1, ey = m[i].y2 - m[i].y1;
+        float den = dx*ey - dy*ex;
+        if (fabs(den) < 1e-6)
+          continue;
+        float wx = m[i].x1 - ox, wy = m[i].y1 - oy;
+        float t = (wx*ey - wy*ex)/den;
+        float u = (wx*dy - wy*dx)/den;
+        if (t > 1e-4 && u >= 0 && u <= 1 && t < best)
+        {
+          hit = i;
+          best = t;
+        }
+      }
+      continue;
+    }
+
+    // visit the nearer child first so it tightens best for the other one
+    int l = node.first, r = node.first + 1;
+    float tl = bvhEnter(b->nodes[l], ox, oy, ix, iy, best);
+    float tr = bvhEnter(b->nodes[r], ox, oy, ix, iy, best);
+    if (tl > tr)
+    {
+      swap(l, r);
+      swap(tl, tr);
+    }
+    if (tr != INFINITY && top < BVH_STACK)
+      stack[top++] = r;
+    if (tl != INFINITY && top < BVH_STACK)
+      stack[top++] = l;
+  }
+
+  *t_hit = best;
+  return hit;
+}
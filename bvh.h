@@ -0,0 +1,25 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "game.h"
+
+/* Bounding volume hierarchy over the mirror segments, so the nearest mirror
+ * along a ray is found in O(log n) instead of testing every mirror.
+ * Built from the mirror array and rebuilt whenever the mirrors change. */
+
+struct bvh_node {
+  float minx, miny, maxx, maxy;
+  int first;   // leaf: first entry in items, inner: index of the left child
+  int count;   // leaf: number of mirrors, inner: 0
+};
+
+struct mirror_bvh {
+  int nodes_used;
+  bvh_node nodes[2*MAX_MIRRORS];
+  int items[MAX_MIRRORS];
+};
+
+void bvhBuild (mirror_bvh* b, const reflectors* m, int n);
+int bvhNearest (const mirror_bvh* b, const reflectors* m, float ox, float oy, float dx, float dy, int skip, float* t_hit);
+
+#endif
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "filewatch.h"
+
+using namespace std;
+
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+bool watchOpen (file_watch* w)
+{
+  memset(w, 0, sizeof(*w));
+  w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (w->fd < 0 || pipe(w->wake) != 0)
+  {
+    perror("filewatch: inotify");
+    if (w->fd >= 0)
+      close(w->fd);
+    w->fd = -1;
+    return false;
+  }
+  return true;
+}
+
+void watchClose (file_watch* w)
+{
+  if (w->fd < 0)
+    return;
+  close(w->fd);
+  close(w->wake[0]);
+  close(w->wake[1]);
+  w->fd = -1;
+}
+
+int watchFile (file_watch* w, const char* path)
+{
+  if (w->files == WATCH_MAX_FILES)
+    return -1;
+  string dir = path, name = path;
+  size_t slash = dir.rfind('/');
+  if (slash == string::npos)
+    dir = ".";
+  else
+  {
+    name = dir.substr(slash + 1);
+    dir.resize(slash == 0 ? 1 : slash);
+  }
+  if (name.empty() || name.size() > NAME_MAX)
+    return -1;
+  // the same directory gives back the same descriptor
+  int wd = inotify_add_watch(w->fd, dir.c_str(), WATCH_EVENTS);
+  if (wd < 0)
+  {
+    fprintf(stderr, "filewatch: cannot watch %s\n", dir.c_str());
+    return -1;
+  }
+  int k = w->files++;
+  w->dir[k] = wd;
+  strcpy(w->name[k], name.c_str());
+  return k;
+}
+
+/* Reads the queued events; the files they touched */
+static unsigned readEvents (file_watch* w)
+{
+  unsigned changed = 0;
+  char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+  ssize_t size;
+  while ((size = read(w->fd, buf, sizeof(buf))) > 0)
+    for (char* p = buf; p < buf + size; )
+    {
+      const inotify_event* e = (const inotify_event*)p;
+      p += sizeof(inotify_event) + e->len;
+      if (e->len == 0)
+        continue;
+      for (int k = 0; k < w->files; k++)
+        if (w->dir[k] == e->wd && strcmp(w->name[k], e->name) == 0)
+          changed |= 1u << k;
+    }
+  return changed;
+}
+
+unsigned watchWait (file_watch* w)
+{
+  unsigned changed = 0;
+  while (true)
+  {
+    pollfd p[2] = { { w->fd, POLLIN, 0 }, { w->wake[0], POLLIN, 0 } };
+    // once something changed, only wait for the writer to finish
+    int n = poll(p, 2, changed ? WATCH_SETTLE_MS : -1);
+    if (p[1].revents)
+      return 0;
+    if (n == 0)
+      return changed;
+    if (n > 0)
+      changed |= readEvents(w);
+  }
+}
+
+void watchWake (file_watch* w)
+{
+  char c = 0;
+  if (write(w->wake[1], &c, 1) < 0)
+    perror("filewatch: wake");
+}
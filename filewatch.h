@@ -0,0 +1,40 @@
+#ifndef FILEWATCH_H
+#define FILEWATCH_H
+
+#include <limits.h>
+
+/* Tells when files are rewritten, through inotify.
+ *
+ * The directories holding the files are watched rather than the files, since
+ * editors and build tools often write a new file and rename it over the old
+ * one, which a watch on the old file would miss. A file counts as changed
+ * when a writer closes it or it is renamed into place. */
+
+#define WATCH_MAX_FILES 16
+/* Quiet time a batch of changes waits for, so a save that writes and renames
+ * several times is one change */
+#define WATCH_SETTLE_MS 50
+
+struct file_watch {
+  int fd;        // inotify, -1 when closed
+  int wake[2];   // pipe that ends a watchWait() from another thread
+  int files;
+  int dir[WATCH_MAX_FILES];  // watch descriptor of each file's directory
+  char name[WATCH_MAX_FILES][NAME_MAX + 1];
+};
+
+/* False, with a message, if inotify is not available */
+bool watchOpen (file_watch* w);
+void watchClose (file_watch* w);
+
+/* Starts watching path; its bit in what watchWait() returns, or -1 */
+int watchFile (file_watch* w, const char* path);
+
+/* Blocks until watched files change. A mask of them, or 0 once watchWake()
+ * was called */
+unsigned watchWait (file_watch* w);
+
+/* Ends the current and every later watchWait(); safe from any thread */
+void watchWake (file_watch* w);
+
+#endif
@@ -0,0 +1,935 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "arena.h"
+#include "game.h"
+#include "bvh.h"
+#include "trace.h"
+
+using namespace std;
+
+/* Simulation state is per thread, so planners can step forked copies of the
+ * game on worker threads (see autopilot.cpp). The level, the mirrors and their
+ * hierarchy and beam_limit are shared, and must not change while copies run */
+thread_local int points = 0;
+thread_local bool gameover = false;
+thread_local int hit_count = 0;
+thread_local float speed = 0.1;
+thread_local bool game_messages = true;
+thread_local const char* game_event = NULL;
+thread_local long game_event_tick = 0;
+thread_local void (*brick_shot_hook) (const rect& brick) = NULL;
+
+thread_local rect boxes[MAX_BOXES];
+thread_local int num_boxes = 15;
+thread_local receptacle bucket[2];
+thread_local cannon gun[2];
+reflectors mirror[MAX_MIRRORS];
+int num_mirrors = 0;
+thread_local rail bullet[MAX_BEAMS];
+thread_local int beams = 0;
+/* Segments a beam may have, the first one plus a bounce per further segment */
+int beam_limit = 10;
+thread_local long tick = 0;
+thread_local bool laser_ready = true;
+thread_local timer_wheel timers;
+
+/* Level being played, NULL for the classic one, and its rules */
+const level_file* level = NULL;
+level_rules rules = classic_rules;
+
+/* Spawn script being played, NULL for random spawns. Pattern bricks go into
+ * slots freed by catches and hits, so the store only grows to the most bricks
+ * ever in play at once */
+thread_local spawn_pattern* pattern = NULL;
+thread_local int free_slots[MAX_BOXES];
+thread_local int num_free = 0;
+thread_local long spawns_dropped = 0;
+
+/* Tick at which the last queued brick drops in. Each respawn queues behind it,
+ * a random gap later, so bricks keep arriving spread out over time */
+thread_local long next_spawn = 0;
+
+enum {
+  TIMER_SPAWN,
+  TIMER_BEAM_OFF,
+  TIMER_COOLDOWN,
+  TIMER_PATTERN
+};
+
+/* Pending catch line crossings, earliest first. An event is stale once its
+ * brick has been respawned (serial changed) and is dropped when popped. */
+struct catch_event {
+  long due;
+  int brick;
+  unsigned int serial;
+};
+
+static bool later (const catch_event& a, const catch_event& b)
+{
+  if (a.due != b.due)
+    return a.due > b.due;
+  return a.brick > b.brick;
+}
+
+thread_local vector<catch_event> catches;
+
+/* Per tick snapshots, slot tick % SNAPSHOT_RING. initGame sizes every slot
+ * for the most bricks the game can have, so taking one does not allocate */
+struct snapshot {
+  long tick;
+  unsigned int capacity;
+  game_state* state;
+};
+
+thread_local snapshot history[SNAPSHOT_RING];
+
+static void reserveSnapshots ();
+
+static void clearSnapshots ()
+{
+  for (int k=0; k<SNAPSHOT_RING; k++)
+    history[k].tick = -1;
+}
+
+/* xorshift32 - own generator so a seed reproduces the same game on every platform */
+thread_local unsigned int rng_state = 1;
+
+void seedGame (unsigned int seed)
+{
+  rng_state = seed ? seed : 1;
+}
+
+int nextRandom ()
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return (int)(rng_state & 0x7fffffff);
+}
+
+/* Plays l (mapped with mapLevel) from the next initGame on, or the classic level if NULL.
+ * The level stays in use, so it must stay mapped until another one replaces it */
+void useLevel (const level_file* l)
+{
+  level = l;
+  rules = l ? l->rules : classic_rules;
+}
+
+/* The level's mirrors, straight out of the mapped file, no parsing */
+static void placeMirrors ()
+{
+  int count = level ? level->num_mirrors : CLASSIC_MIRRORS;
+  const float* m = level ? levelFloats(level, level->mirror_offset) : classic_mirrors[0];
+  clearMirrors();
+  for (int k=0;k<count && addMirror(m[4*k], m[4*k+1], m[4*k+2], m[4*k+3]) != -1;k++)
+    ;
+}
+
+/* Switches to level l in the middle of a game. The mirrors, baskets and
+ * cannon go where l puts them, keeping how far the player has moved them;
+ * bricks in play keep their size until they respawn. Not for the planner's
+ * threads, which share the mirrors, while they run */
+void swapLevel (const level_file* l)
+{
+  useLevel(l);
+  placeMirrors();
+  for (int j=0;j<2;j++)
+  {
+    bucket[j].x1 = rules.basket_x1[j] + bucket[j].translate;
+    bucket[j].x2 = rules.basket_x2[j] + bucket[j].translate;
+    bucket[j].c = rules.basket_c[j];
+  }
+  gun[0].x = rules.cannon_x;
+  gun[1].x = rules.cannon_mouth;
+  for (int j=0;j<2;j++)
+    gun[j].y = rules.cannon_y + gun[j].translate;
+}
+
+/* Spawns bricks from p (opened with openPattern) from the next initGame on,
+ * or at random if NULL */
+void usePattern (spawn_pattern* p)
+{
+  pattern = p;
+}
+
+/* Places the cannon, baskets and mirrors and spawns the first set of bricks.
+ * bricks = 0 uses the level's brick count */
+void initGame (unsigned int seed, int bricks)
+{
+  seedGame(seed);
+
+  points = 0;
+  gameover = false;
+  hit_count = 0;
+  speed = 0.1;
+  beams = 0;
+  tick = 0;
+  laser_ready = true;
+  next_spawn = 0;
+  catches.clear();
+  // one pending crossing per brick, plus stale ones, without growing in play
+  catches.reserve(2*MAX_BOXES);
+  wheelInit(&timers, tick);
+  clearSnapshots();
+
+  gun[0].x = rules.cannon_x;
+  gun[0].y = rules.cannon_y;
+  gun[0].translate = 0.0;
+
+  gun[1].x = rules.cannon_mouth;
+  gun[1].y = rules.cannon_y;
+  gun[1].translate = 0.0;
+  aimCannon(0);
+
+  for (int j=0;j<2;j++)
+  {
+    bucket[j].x1 = rules.basket_x1[j];
+    bucket[j].x2 = rules.basket_x2[j];
+    bucket[j].c = rules.basket_c[j];
+    bucket[j].translate = 0.0;
+  }
+
+  placeMirrors();
+
+  if (pattern)
+  {
+    num_boxes = 0;
+    num_free = 0;
+    spawns_dropped = 0;
+    rewindPattern(pattern);
+    wheelAdd(&timers, tick, TIMER_PATTERN, 0);
+    reserveSnapshots();
+    return;
+  }
+
+  if (bricks <= 0)
+    bricks = rules.bricks;
+  if (bricks > MAX_BOXES)
+    bricks = MAX_BOXES;
+  num_boxes = bricks;
+  for (int i=0; i<num_boxes; i++)
+  {
+    boxes[i].alive = false;
+    queueSpawn(i);
+  }
+  reserveSnapshots();
+}
+
+/* Brick i drops in at the top of the screen at x, colour c (1 = red, 2 = green, 0 = black) */
+void placeBrick (int i, float x, int c)
+{
+  TRACE_INSTANT("brick_spawn", i);
+  boxes[i].x1 = x;
+  boxes[i].x2 = x+rules.brick_w;
+  boxes[i].y1 = rules.spawn_y;
+  boxes[i].y2 = rules.spawn_y+rules.brick_h;
+  boxes[i].c = c;
+  boxes[i].alive = true;
+  boxes[i].translation = 0.0f;
+  boxes[i].serial++;
+  scheduleCatch(i);
+}
+
+/* Brick i drops in somewhere in the level's spawn range */
+void spawnBrick (int i)
+{
+  int x = nextRandom() % rules.spawn_width + rules.spawn_x;
+  int c = nextRandom() % 3;
+  placeBrick(i, x, c);
+}
+
+/* Free slot for a pattern brick, reusing freed ones first. -1 when all MAX_BOXES are in play */
+int takeBrick ()
+{
+  if (num_free > 0)
+    return free_slots[--num_free];
+  if (num_boxes == MAX_BOXES)
+    return -1;
+  boxes[num_boxes].alive = false;
+  return num_boxes++;
+}
+
+/* Spawns the pattern bricks due by now and arms the timer for the next ones */
+void playPattern ()
+{
+  const spawn_record* r;
+  long due;
+  while ((r = nextSpawn(pattern, &due)) != NULL && due <= tick)
+  {
+    int i = takeBrick();
+    if (i == -1)
+      spawns_dropped++;
+    else
+    {
+      float x = r->flags & SPAWN_RANDOM_X ? nextRandom() % rules.spawn_width + rules.spawn_x : r->x;
+      int c = r->c == SPAWN_RANDOM_C ? nextRandom() % 3 : r->c;
+      placeBrick(i, x, c);
+    }
+    popSpawn(pattern);
+  }
+  if (r != NULL)
+    wheelAdd(&timers, due, TIMER_PATTERN, 0);
+}
+
+/* Queues the tick at which brick i reaches the catch line at the current speed */
+void scheduleCatch (int i)
+{
+  catch_event e;
+  e.due = tick;
+  if (boxes[i].y2 > -36)
+    e.due += (long)ceil((boxes[i].y2 + 36) / speed);
+  e.brick = i;
+  e.serial = boxes[i].serial;
+  catches.push_back(e);
+  push_heap(catches.begin(), catches.end(), later);
+}
+
+/* Rebuilds every pending crossing, after a speed change or after bricks were moved by hand */
+void rescheduleCatches ()
+{
+  catches.clear();
+  for (int i=0;i<num_boxes;i++)
+    scheduleCatch(i);
+}
+
+/* Clamped to MIN_SPEED..MAX_SPEED: catches and spawns are scheduled by
+ * dividing by the speed, and a brick that never falls is never caught */
+void setSpeed (float s)
+{
+  if (!(s >= MIN_SPEED))
+    s = MIN_SPEED;
+  else if (s > MAX_SPEED)
+    s = MAX_SPEED;
+  if (s == speed)
+    return;
+  speed = s;
+  rescheduleCatches();
+}
+
+void moveBricks ()
+{
+  for (int i=0;i<num_boxes;i++)
+  {
+    boxes[i].y1 -= speed;
+    boxes[i].y2 -= speed;
+    boxes[i].translation -= speed;
+  }
+}
+
+/* Schedules brick i to drop in a random gap after the last queued brick.
+ * The gap is up to the level's spawn_gap units of fall at the current speed */
+void queueSpawn (int i)
+{
+  long gap = (long)ceil((nextRandom() % rules.spawn_gap) / speed);
+  next_spawn = max(next_spawn, tick) + gap;
+  wheelAdd(&timers, next_spawn, TIMER_SPAWN, i);
+}
+
+/* Brick i was caught or shot; it leaves the field until its spawn timer fires,
+ * or gives its slot back to the store when a pattern is playing */
+void respawnBrick (int i)
+{
+  boxes[i].alive = false;
+  if (pattern)
+    free_slots[num_free++] = i;
+  else
+    queueSpawn (i);
+}
+
+/* Fires the laser if it has cooled down. The beam lasts BEAM_LIFETIME ticks */
+bool pullTrigger ()
+{
+  if (!laser_ready)
+    return false;
+
+  TRACE_SCOPE("laser_fire");
+  fireLaser();
+  laser_ready = false;
+  wheelAdd(&timers, tick + BEAM_LIFETIME, TIMER_BEAM_OFF, 0);
+  wheelAdd(&timers, tick + LASER_COOLDOWN, TIMER_COOLDOWN, 0);
+  return true;
+}
+
+/* Handles the spawns, beam expiries and cooldowns due this tick */
+void runTimers ()
+{
+  int kind, arg;
+
+  wheelAdvance(&timers, tick);
+  while (wheelPop(&timers, &kind, &arg))
+  {
+    switch (kind) {
+      case TIMER_SPAWN:
+        spawnBrick(arg);
+        break;
+      case TIMER_BEAM_OFF:
+        beams = 0;
+        break;
+      case TIMER_COOLDOWN:
+        laser_ready = true;
+        break;
+      case TIMER_PATTERN:
+        if (pattern)
+          playPattern();
+        break;
+    }
+  }
+}
+
+/* One simulation tick: timers, catches, laser hits, then the fall */
+void stepGame ()
+{
+  runTimers ();
+  score ();
+  for (int i=0;i<beams;i++)
+    shoot (i);
+  moveBricks ();
+  tick++;
+}
+
+/* Turns the cannon to angle radians. The only place its direction is computed */
+void aimCannon (float angle)
+{
+  float dx = cos(angle), dy = sin(angle);
+  for (int j=0;j<2;j++)
+  {
+    gun[j].rotate = angle;
+    gun[j].dx = dx;
+    gun[j].dy = dy;
+  }
+}
+
+void placeLaser (float x1, float y1, float x2, float y2, float dx, float dy, int i)
+{
+  if (x2 == 0 && y2 == 0)
+  {
+    x2 = x1+100*dx;
+    y2 = y1+100*dy;
+  }
+
+  bullet[i].x1 = x1;
+  bullet[i].x2 = x2;
+  bullet[i].y1 = y1;
+  bullet[i].y2 = y2;
+  bullet[i].dx = dx;
+  bullet[i].dy = dy;
+}
+
+/* Cached beam polyline and the cannon pose / mirror set it was traced for */
+thread_local beam_path path_cache;
+thread_local float path_key[7];
+thread_local unsigned int path_mirrors = 0;
+unsigned int mirror_version = 1;
+
+/* Mirror hierarchy, rebuilt on the first trace after the mirrors changed */
+mirror_bvh mirror_tree;
+unsigned int tree_mirrors = 0;
+
+/* Adds a reflecting segment. Returns its index, or -1 when the level is full */
+int addMirror (float x1, float y1, float x2, float y2)
+{
+  if (num_mirrors == MAX_MIRRORS)
+    return -1;
+
+  reflectors& r = mirror[num_mirrors];
+  r.x1 = x1;
+  r.y1 = y1;
+  r.x2 = x2;
+  r.y2 = y2;
+  float len = sqrt((x2 - x1)*(x2 - x1) + (y2 - y1)*(y2 - y1));
+  r.ux = len > 0 ? (x2 - x1)/len : 1;
+  r.uy = len > 0 ? (y2 - y1)/len : 0;
+  r.nx = -r.uy;
+  r.ny = r.ux;
+  mirrorsChanged();
+  return num_mirrors++;
+}
+
+void clearMirrors ()
+{
+  num_mirrors = 0;
+  mirrorsChanged();
+}
+
+/* Call after moving, adding or removing a mirror */
+void mirrorsChanged ()
+{
+  mirror_version++;
+}
+
+/* Follows the beam from the cannon mouth, reflecting off the nearest mirror
+ * along the ray each time, until it leaves the scene or beam_limit segments */
+static void traceBeam (beam_path& p)
+{
+  if (tree_mirrors != mirror_version)
+  {
+    bvhBuild(&mirror_tree, mirror, num_mirrors);
+    tree_mirrors = mirror_version;
+  }
+
+  int limit = beam_limit < 1 ? 1 : (beam_limit > MAX_BEAMS ? MAX_BEAMS : beam_limit);
+  float dx = gun[1].dx, dy = gun[1].dy;
+  float x1 = gun[0].x + (gun[1].x - gun[0].x)*dx;
+  float y1 = gun[1].y + (gun[1].x - gun[0].x)*dy;
+  int last = -1;
+
+  for (int n=0;;n++)
+  {
+    float t;
+    // skip the mirror the beam just left
+    int hit = bvhNearest(&mirror_tree, mirror, x1, y1, dx, dy, last, &t);
+
+    p.x[n] = x1;
+    p.y[n] = y1;
+    p.dx[n] = dx;
+    p.dy[n] = dy;
+    if (hit == -1 || n == limit-1)
+    {
+      p.x[n+1] = x1+100*dx;
+      p.y[n+1] = y1+100*dy;
+      p.segments = n+1;
+      return;
+    }
+
+    x1 += t*dx;
+    y1 += t*dy;
+    // d' = d - 2(d.n)n
+    float dn = 2*(dx*mirror[hit].nx + dy*mirror[hit].ny);
+    dx -= dn*mirror[hit].nx;
+    dy -= dn*mirror[hit].ny;
+    last = hit;
+  }
+}
+
+/* Beam path for the current cannon pose, retraced only when the cannon or a mirror moved */
+const beam_path& beamPath ()
+{
+  float key[7] = { gun[0].x, gun[0].y, gun[1].x, gun[1].y, gun[1].dx, gun[1].dy, (float)beam_limit };
+  if (path_mirrors != mirror_version || memcmp(key, path_key, sizeof(key)) != 0)
+  {
+    traceBeam(path_cache);
+    memcpy(path_key, key, sizeof(key));
+    path_mirrors = mirror_version;
+  }
+  return path_cache;
+}
+
+/* Puts the beam on screen along the current path. Returns the number of segments */
+int fireLaser ()
+{
+  const beam_path& p = beamPath();
+  for (int k=0;k<p.segments;k++)
+    placeLaser (p.x[k],p.y[k],p.x[k+1],p.y[k+1],p.dx[k],p.dy[k],k);
+
+  beams = p.segments;
+  return beams;
+}
+
+/* Nearest brick crossed by beam segment i, or -1. Does not change any state.
+ * Works along the segment's direction vector, so vertical beams are fine */
+int laserTarget (int i, float* hit_x, float* hit_y)
+{
+  const rail& r = bullet[i];
+  // the beam's line is n.p = d; a brick is crossed only if its corners straddle it
+  float nx = -r.dy, ny = r.dx, d = 2*(nx*r.x1 + ny*r.y1);
+  float anx = fabs(nx), any = fabs(ny);
+  // a huge finite reciprocal for an axis parallel beam keeps the slab test free of NaNs
+  float ix = r.dx != 0 ? 1 / r.dx : 1e30f;
+  float iy = r.dy != 0 ? 1 / r.dy : 1e30f;
+  float best = (r.x2 - r.x1)*r.dx + (r.y2 - r.y1)*r.dy;
+  int min = -1;
+
+  for (int j=0;j<num_boxes;j++)
+  {
+    if (!boxes[j].alive || boxes[j].y1 >= 40 || boxes[j].y2 <= -36)
+      continue;
+
+    // distance of the centre from the line against the brick's extent along n, both doubled
+    const rect& b = boxes[j];
+    if (fabs(nx*(b.x1 + b.x2) + ny*(b.y1 + b.y2) - d) > anx*(b.x2 - b.x1) + any*(b.y2 - b.y1))
+      continue;
+
+    // entry distance of the beam into the brick, slab by slab
+    float ax = (b.x1 - r.x1)*ix, bx = (b.x2 - r.x1)*ix;
+    float ay = (b.y1 - r.y1)*iy, by = (b.y2 - r.y1)*iy;
+    float t0 = std::max(std::max(std::min(ax, bx), std::min(ay, by)), 0.0f);
+    float t1 = std::min(std::max(ax, bx), std::max(ay, by));
+    if (t0 <= t1 && t0 < best)
+    {
+      best = t0;
+      min = j;
+    }
+  }
+
+  if (min == -1)
+  {
+    *hit_x = r.x2;
+    *hit_y = r.y2;
+  }
+  else
+  {
+    *hit_x = r.x1 + best*r.dx;
+    *hit_y = r.y1 + best*r.dy;
+  }
+  return min;
+}
+
+/* Something worth telling the player happened this tick; the window shows it */
+static void event (const char* text)
+{
+  game_event = text;
+  game_event_tick = tick;
+}
+
+/* Beam segment i destroys the first brick in its way. Returns the brick hit or -1 */
+int shoot (int i)
+{
+  float x2,y2;
+  int min = laserTarget(i, &x2, &y2);
+
+  if (min != -1)
+  {
+      TRACE_INSTANT("shot_hit", boxes[min].c);
+      if (boxes[min].c > 0)
+      {
+        hit_count ++;
+        points += 10;
+        event("Nice shot +10");
+        if (game_messages)
+        {
+          cout<<"Nice shot, you earned 10 points"<<endl;
+          cout<<"Score = "<<points<<endl;
+        }
+        if (hit_count >= LASER_LIMIT)
+        {
+          if (game_messages)
+          {
+            cout<<"This was your 500th hit. Remember next time that you have only limited lasers."<<endl;
+            cout<<"GAMEOVER"<<endl;
+          }
+          gameover = true;
+        }
+        else if (hit_count >= LASER_LIMIT - 100 && game_messages)
+          cout<<"Use your lasers wisely. You have only "<<hit_count<<" remaining"<<endl;
+      }
+      else if (boxes[min].c == 0)
+      {
+        hit_count += 5;
+        points -= 5;
+        event("Black brick shot -5 points -5 lasers");
+        if (game_messages)
+        {
+          cout<<"Whoops you shot a black brick, you lose 5 points and 5 lasers"<<endl;
+          cout<<"Score = "<<points<<endl;
+        }
+        if (hit_count >= LASER_LIMIT)
+        {
+          if (game_messages)
+          {
+            cout<<"This was your 500th hit. Remember next time that you have only limited lasers."<<endl;
+            cout<<"GAMEOVER"<<endl;
+          }
+          gameover = true;
+        }
+        else if (hit_count >= LASER_LIMIT - 100 && game_messages)
+          cout<<"Use your lasers wisely. You have only "<<hit_count<<" remaining"<<endl;
+      }
+      // the beam stops at the brick, later segments disappear
+      placeLaser(bullet[i].x1,bullet[i].y1,x2,y2,bullet[i].dx,bullet[i].dy,i);
+      beams = i+1;
+      if (brick_shot_hook != NULL)
+        brick_shot_hook(boxes[min]);
+      respawnBrick(min);
+  }
+  return min;
+}
+
+/* Brick i reached the catch line; scores it against the baskets where they are now */
+void catchBrick (int i)
+{
+  for (int j=0;j<2;j++)
+  {
+    if (boxes[i].x1 >= bucket[j].x1 && boxes[i].x2 <= bucket[j].x2)
+    {
+      TRACE_INSTANT("catch", boxes[i].c);
+      if (bucket[j].c == boxes[i].c)
+      {
+        points += 10;
+        event("Nice catch +10");
+        if (game_messages)
+        {
+          cout<<"Nice catch, you earned 10 points"<<endl;
+          cout<<"Score = "<<points<<endl;
+        }
+      }
+      else if (boxes[i].c == 0)
+      {
+        event("You caught the black brick!");
+        if (game_messages)
+        {
+          cout<<"You caught the black brick!"<<endl;
+          cout<<"GAMEOVER"<<endl;
+        }
+        gameover = true;
+      }
+      else
+      {
+        points -= 5;
+        event("Wrong basket -5");
+        if (game_messages)
+        {
+          cout<<"Oops, wrong basket, you lose 5 points"<<endl;
+          cout<<"Score = "<<points<<endl;
+        }
+      }
+    }
+  }
+}
+
+/* Resolves the catch line crossings due this tick. Every brick is scored
+ * exactly once per fall, then respawned */
+void score ()
+{
+  while (!catches.empty() && catches.front().due <= tick)
+  {
+    catch_event e = catches.front();
+    pop_heap(catches.begin(), catches.end(), later);
+    catches.pop_back();
+
+    int i = e.brick;
+    if (e.serial != boxes[i].serial || !boxes[i].alive)
+      continue;
+    // the predicted tick can be early by float rounding of the per tick fall
+    if (boxes[i].y2 > -36)
+    {
+      scheduleCatch(i);
+      continue;
+    }
+
+    catchBrick(i);
+    respawnBrick(i);
+  }
+}
+
+/* Where each array of a game_state starts; timers and catches hold longs, so they go first */
+struct state_layout {
+  unsigned int timers, catches, boxes, free, beams, end;
+};
+
+static state_layout layout (int num_timers, int num_catches, int num_boxes, int num_free, int num_beams)
+{
+  state_layout l;
+  l.timers = (sizeof(game_state) + 7) & ~7u;
+  l.catches = l.timers + num_timers * sizeof(timer);
+  l.boxes = l.catches + num_catches * sizeof(catch_event);
+  l.free = l.boxes + num_boxes * sizeof(rect);
+  l.beams = l.free + num_free * sizeof(int);
+  l.end = l.beams + num_beams * sizeof(rail);
+  return l;
+}
+
+/* Writes the game state to s if it fits in capacity bytes. Returns the bytes
+ * written, or more than capacity (the room it needs) if it did not fit */
+unsigned int saveState (game_state* s, unsigned int capacity)
+{
+  state_layout l = layout(timers.armed, catches.size(), num_boxes, pattern ? num_free : 0, beams);
+  if (l.end > capacity)
+    return l.end;
+
+  char* base = (char*)s;
+  s->tick = tick;
+  s->wheel_now = timers.now;
+  s->next_spawn = next_spawn;
+  s->pattern_base = 0;
+  s->pattern_index = pattern ? tellPattern(pattern, &s->pattern_base) : 0;
+  s->spawns_dropped = spawns_dropped;
+  s->rng = rng_state;
+  s->points = points;
+  s->hit_count = hit_count;
+  s->speed = speed;
+  s->gameover = gameover;
+  s->laser_ready = laser_ready;
+  s->num_boxes = num_boxes;
+  s->num_free = pattern ? num_free : 0;
+  s->beams = beams;
+  memcpy(s->bucket, bucket, sizeof(bucket));
+  memcpy(s->gun, gun, sizeof(gun));
+
+  s->num_timers = wheelSave(&timers, (timer*)(base + l.timers));
+  // the heap as it is, stale events and all, so it pops in the same order
+  s->num_catches = catches.size();
+  if (!catches.empty())
+    memcpy(base + l.catches, &catches[0], catches.size() * sizeof(catch_event));
+  memcpy(base + l.boxes, boxes, num_boxes * sizeof(rect));
+  memcpy(base + l.free, free_slots, s->num_free * sizeof(int));
+  memcpy(base + l.beams, bullet, beams * sizeof(rail));
+  s->size = l.end;
+  return l.end;
+}
+
+/* Puts the game back exactly as it was when s was saved */
+void loadState (const game_state* s)
+{
+  const char* base = (const char*)s;
+  state_layout l = layout(s->num_timers, s->num_catches, s->num_boxes, s->num_free, s->beams);
+
+  tick = s->tick;
+  next_spawn = s->next_spawn;
+  if (pattern)
+    seekPattern(pattern, s->pattern_base, s->pattern_index);
+  spawns_dropped = s->spawns_dropped;
+  rng_state = s->rng;
+  points = s->points;
+  hit_count = s->hit_count;
+  speed = s->speed;
+  gameover = s->gameover;
+  laser_ready = s->laser_ready;
+  num_boxes = s->num_boxes;
+  num_free = s->num_free;
+  beams = s->beams;
+  memcpy(bucket, s->bucket, sizeof(bucket));
+  memcpy(gun, s->gun, sizeof(gun));
+
+  wheelRestore(&timers, s->wheel_now, (const timer*)(base + l.timers), s->num_timers);
+
+  // the room initGame gives it, also on threads that never started a game
+  catches.reserve(2*MAX_BOXES);
+  const catch_event* c = (const catch_event*)(base + l.catches);
+  catches.assign(c, c + s->num_catches);
+
+  memcpy(boxes, base + l.boxes, num_boxes * sizeof(rect));
+  memcpy(free_slots, base + l.free, num_free * sizeof(int));
+  memcpy(bullet, base + l.beams, beams * sizeof(rail));
+}
+
+/* Gives every ring slot room for the largest state this game can save: a
+ * pattern may fill all MAX_BOXES slots, random play keeps num_boxes. Each
+ * brick has at most one spawn timer, and the beam, cooldown and pattern
+ * timers one each; initGame reserves the catch heap for two per brick */
+static void reserveSnapshots ()
+{
+  int most = pattern ? MAX_BOXES : num_boxes;
+  unsigned int need = layout(most + 3, 2*most, most, pattern ? most : 0, MAX_BEAMS).end;
+  for (int k=0; k<SNAPSHOT_RING; k++)
+  {
+    if (history[k].capacity >= need)
+      continue;
+    game_state* s = (game_state*)heapRealloc(history[k].state, need);
+    if (s == NULL)
+    {
+      cerr<<"game: no memory for "<<SNAPSHOT_RING<<" snapshots of "<<need<<" bytes"<<endl;
+      return;
+    }
+    history[k].state = s;
+    history[k].capacity = need;
+  }
+}
+
+/* Keeps the state at the start of this tick; call before stepGame() */
+void snapshotTick ()
+{
+  snapshot& h = history[tick % SNAPSHOT_RING];
+  unsigned int need = saveState(h.state, h.capacity);
+  if (need > h.capacity)
+  {
+    // more stale catches than reserveSnapshots allowed for: grow this slot
+    game_state* s = (game_state*)heapRealloc(h.state, need * 2);
+    if (s == NULL)
+    {
+      // keep the old buffer; there is just no rolling back to this tick
+      h.tick = -1;
+      return;
+    }
+    h.state = s;
+    h.capacity = need * 2;
+    saveState(h.state, h.capacity);
+  }
+  h.tick = tick;
+}
+
+/* Puts the game back to the start of tick t, if t is still in the ring.
+ * Later snapshots belong to the abandoned timeline and are dropped */
+bool rollbackTo (long t)
+{
+  if (t < 0 || history[t % SNAPSHOT_RING].tick != t || history[t % SNAPSHOT_RING].state == NULL)
+    return false;
+  loadState(history[t % SNAPSHOT_RING].state);
+  for (int k=0; k<SNAPSHOT_RING; k++)
+    if (history[k].tick > t)
+      history[k].tick = -1;
+  return true;
+}
+
+/* Hashes for replay checks: xxHash64's round and final mix, fed 64 bit words */
+#define HASH_P1 0x9E3779B185EBCA87ull
+#define HASH_P2 0xC2B2AE3D27D4EB4Full
+#define HASH_P3 0x165667B19E3779F9ull
+
+static inline uint64_t hashRound (uint64_t h, uint64_t v)
+{
+  h += v * HASH_P2;
+  h = (h << 31) | (h >> 33);
+  return h * HASH_P1;
+}
+
+static inline uint64_t bits (float a, float b)
+{
+  uint32_t x, y;
+  memcpy(&x, &a, 4);
+  memcpy(&y, &b, 4);
+  return (uint64_t)x << 32 | y;
+}
+
+/* Fingerprint of what the player sees and scores: bricks, baskets, cannon,
+ * beams, points, lasers used, plus the tick, speed and generator. Fields are
+ * hashed one by one, never padding, so equal states hash equal on every
+ * build. Each brick slot is four words, one per lane, so the lanes run in
+ * parallel: a few nanoseconds a brick, a small part of a tick. It is a full
+ * pass rather than a running hash on purpose: moveBricks() changes every
+ * brick every tick, so a running hash would touch each slot anyway, and
+ * one recomputed from the state cannot drift after loadState() or a
+ * rollback */
+uint64_t stateHash ()
+{
+  uint64_t lane[4] = { HASH_P1 + HASH_P2, HASH_P2, 0, 0 - HASH_P1 };
+  for (int i=0;i<num_boxes;i++)
+  {
+    const rect& b = boxes[i];
+    lane[0] = hashRound(lane[0], bits(b.x1, b.y1));
+    lane[1] = hashRound(lane[1], bits(b.x2, b.y2));
+    lane[2] = hashRound(lane[2], bits(b.translation, 0) | (uint32_t)b.c);
+    lane[3] = hashRound(lane[3], (uint64_t)b.serial << 32 | b.alive);
+  }
+  for (int j=0;j<2;j++)
+  {
+    lane[0] = hashRound(lane[0], bits(bucket[j].x1, bucket[j].x2));
+    lane[1] = hashRound(lane[1], bits(bucket[j].translate, 0) | (uint32_t)bucket[j].c);
+    lane[2] = hashRound(lane[2], bits(gun[j].x, gun[j].y));
+    lane[3] = hashRound(lane[3], bits(gun[j].translate, gun[j].rotate));
+    lane[0] = hashRound(lane[0], bits(gun[j].dx, gun[j].dy));
+  }
+  for (int i=0;i<beams;i++)
+  {
+    lane[1] = hashRound(lane[1], bits(bullet[i].x1, bullet[i].y1));
+    lane[2] = hashRound(lane[2], bits(bullet[i].x2, bullet[i].y2));
+    lane[3] = hashRound(lane[3], bits(bullet[i].dx, bullet[i].dy));
+  }
+  lane[0] = hashRound(lane[0], (uint64_t)tick);
+  lane[1] = hashRound(lane[1], (uint64_t)(uint32_t)points << 32 | (uint32_t)hit_count);
+  lane[2] = hashRound(lane[2], bits(speed, 0) | (uint32_t)beams);
+  lane[3] = hashRound(lane[3], (uint64_t)rng_state << 2 | gameover << 1 | laser_ready);
+
+  uint64_t h = ((lane[0] << 1) | (lane[0] >> 63)) + ((lane[1] << 7) | (lane[1] >> 57)) +
+               ((lane[2] << 12) | (lane[2] >> 52)) + ((lane[3] << 18) | (lane[3] >> 46));
+  h ^= h >> 33;
+  h *= HASH_P2;
+  h ^= h >> 29;
+  h *= HASH_P3;
+  h ^= h >> 32;
+  return h;
+}
@@ -0,0 +1,184 @@
+#ifndef GAME_H
+#define GAME_H
+
+#include "timer.h"
+#include "level.h"
+#include "pattern.h"
+
+/* Game state and rules. Nothing in here touches GL or GLFW, so the
+ * simulation can run headless (benchmarks, training runs). */
+
+#define MAX_BOXES 4096
+#define MAX_BEAMS 64
+#define MAX_MIRRORS 1024
+
+/* Durations in simulation ticks; the game runs at 60 ticks per second */
+#define TICK_RATE 60
+#define LASER_COOLDOWN 60
+#define BEAM_LIFETIME 12
+/* Bricks the laser may hit in a game; a black brick counts as 5 */
+#define LASER_LIMIT 500
+/* Brick fall per tick, the range N and M step through */
+#define MIN_SPEED 0.1f
+#define MAX_SPEED 0.5f
+
+struct rect{
+	float x1;
+	float x2;
+	float y1;
+	float y2;
+	float translation;
+	int c;
+	bool alive;
+	unsigned int serial;
+};
+
+struct receptacle{
+  float x1;
+  float x2;
+  float translate;
+  int c;
+};
+
+/* Directions are stored as unit vectors so the hot paths never call
+ * sin/cos/tan; rotate is kept only for turning the cannon by an angle */
+struct cannon{
+  float x;
+  float y;
+  float translate;
+  float rotate;
+  float dx;  // cos(rotate), set by aimCannon()
+  float dy;  // sin(rotate)
+};
+
+struct reflectors{
+  float x1;
+  float x2;
+  float y1;
+  float y2;
+  float ux;  // unit vector from (x1,y1) to (x2,y2)
+  float uy;
+  float nx;  // unit normal
+  float ny;
+};
+
+struct rail{
+  float x1;
+  float x2;
+  float y1;
+  float y2;
+  float dx;  // unit direction of travel
+  float dy;
+};
+
+/* Beam from the cannon through the mirrors: segment k runs from
+ * (x[k], y[k]) to (x[k+1], y[k+1]) along the unit vector (dx[k], dy[k]) */
+struct beam_path {
+  int segments;
+  float x[MAX_BEAMS+1];
+  float y[MAX_BEAMS+1];
+  float dx[MAX_BEAMS];
+  float dy[MAX_BEAMS];
+};
+
+/* Snapshot of everything that changes during play, as one flat block: this
+ * header, then the armed timers, the pending catches, the bricks, the free
+ * brick slots and the beams, each array only as long as it is in use. The
+ * level, the mirrors and settings such as beam_limit are not part of it. */
+struct game_state {
+  unsigned int size;  // bytes, header and arrays
+  long tick;
+  long wheel_now;
+  long next_spawn;
+  long pattern_base;
+  long spawns_dropped;
+  unsigned int pattern_index;
+  unsigned int rng;
+  int points;
+  int hit_count;
+  float speed;
+  bool gameover;
+  bool laser_ready;
+  int num_timers;
+  int num_catches;
+  int num_boxes;
+  int num_free;
+  int beams;
+  receptacle bucket[2];
+  cannon gun[2];
+};
+
+/* Ticks of history kept for rollback */
+#define SNAPSHOT_RING 64
+
+extern thread_local int points;
+extern thread_local bool gameover;
+extern thread_local int hit_count;
+extern thread_local float speed;
+extern thread_local bool game_messages;
+/* Latest message for the player and the tick it was raised; presentation
+ * only, not part of the saved state or the hash */
+extern thread_local const char* game_event;
+extern thread_local long game_event_tick;
+/* Called with each brick the laser destroys, before it respawns; NULL by
+ * default. Only for effects: a rolled back tick calls it again when replayed */
+extern thread_local void (*brick_shot_hook) (const rect& brick);
+
+extern thread_local rect boxes[MAX_BOXES];
+extern thread_local int num_boxes;
+extern thread_local receptacle bucket[2];
+extern thread_local cannon gun[2];
+extern reflectors mirror[MAX_MIRRORS];
+extern int num_mirrors;
+extern thread_local rail bullet[MAX_BEAMS];
+extern thread_local int beams;
+extern int beam_limit;
+extern thread_local long tick;
+extern thread_local bool laser_ready;
+extern thread_local timer_wheel timers;
+extern const level_file* level;
+extern level_rules rules;
+extern thread_local spawn_pattern* pattern;
+extern thread_local long spawns_dropped;
+
+void seedGame (unsigned int seed);
+int nextRandom ();
+void useLevel (const level_file* l);
+void swapLevel (const level_file* l);
+void usePattern (spawn_pattern* p);
+void initGame (unsigned int seed, int bricks = 0);
+
+void placeBrick (int i, float x, int c);
+void spawnBrick (int i);
+int takeBrick ();
+void playPattern ();
+void moveBricks ();
+void queueSpawn (int i);
+void respawnBrick (int i);
+void runTimers ();
+void stepGame ();
+void setSpeed (float s);
+
+void scheduleCatch (int i);
+void rescheduleCatches ();
+void catchBrick (int i);
+
+void aimCannon (float angle);
+void placeLaser (float x1, float y1, float x2, float y2, float dx, float dy, int i);
+int addMirror (float x1, float y1, float x2, float y2);
+void clearMirrors ();
+void mirrorsChanged ();
+const beam_path& beamPath ();
+int fireLaser ();
+bool pullTrigger ();
+int laserTarget (int i, float* hit_x, float* hit_y);
+
+unsigned int saveState (game_state* s, unsigned int capacity);
+void loadState (const game_state* s);
+void snapshotTick ();
+bool rollbackTo (long t);
+uint64_t stateHash ();
+int shoot (int i);
+void score ();
+
+#endif
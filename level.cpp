@@ -0,0 +1,284 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "level.h"
+
+using namespace std;
+
+/* The original hard-coded level, also the defaults for anything a level source leaves out */
+const level_rules classic_rules = {
+  15,              // bricks
+  -20, 50, 20,     // spawn x, width, gap
+  42,              // spawn y
+  1.5, 2.5,        // brick size
+  -39, -31, 0,     // cannon pivot, mouth, y
+  { 10.5, -21.5 }, // baskets
+  { 21.5, -10.5 },
+  { 2, 1 }
+};
+
+const float classic_mirrors[CLASSIC_MIRRORS][4] = {
+  { -1, -2, 4, 6.6602540378f },
+  { 28, -25, 36, -20.3811978f },
+  { 25, 32, 32, 25 }
+};
+
+// black = 0, red = 1, green = 2
+static const float colours[3][3] = {
+  {0,0,0},
+  {1,0,0},
+  {0,1,0}
+};
+
+/* Level blob under construction; floats are appended at 4 byte aligned offsets */
+struct level_writer {
+  vector<char> buf;
+
+  uint32_t append (const float* f, int n)
+  {
+    uint32_t offset = buf.size();
+    buf.insert(buf.end(), (const char*)f, (const char*)(f + n));
+    return offset;
+  }
+
+  level_file* header () { return (level_file*)&buf[0]; }
+};
+
+/* Adds mesh id as triangles with the given corners and one colour */
+static void addMesh (level_writer& w, int id, const float (*xy)[2], int vertices, const float* rgb)
+{
+  vector<float> pos, col;
+  for (int v=0; v<vertices; v++)
+  {
+    pos.push_back(xy[v][0]);
+    pos.push_back(xy[v][1]);
+    pos.push_back(0);
+    col.insert(col.end(), rgb, rgb + 3);
+  }
+  uint32_t vo = w.append(&pos[0], pos.size());
+  uint32_t co = w.append(&col[0], col.size());
+  level_mesh& m = w.header()->mesh[id];
+  m.vertices = vertices;
+  m.vertex_offset = vo;
+  m.color_offset = co;
+}
+
+/* Cannon, baskets and bricks, shaped as in the original game around the level's positions */
+static void buildMeshes (level_writer& w, const level_rules& r)
+{
+  float x = r.cannon_x, y = r.cannon_y, m = r.cannon_mouth;
+
+  const float outer[3][2] = { {x-1, y+6}, {x+3, y}, {x-1, y-6} };
+  const float grey[3] = { 0.3, 0.3, 0.3 };
+  addMesh(w, MESH_CANNON_OUTER, outer, 3, grey);
+
+  const float inner[3][2] = { {x-1, y+5}, {x+2.5f, y}, {x-1, y-5} };
+  const float white[3] = { 1, 1, 1 };
+  addMesh(w, MESH_CANNON_INNER, inner, 3, white);
+
+  const float barrel[3] = { 0.2, 0.2, 0 };
+  const float rear[6][2] = {
+    {x, y+2.2f}, {x, y-2.2f}, {x+4.5f, y-1.7f},
+    {x, y+2.2f}, {x+4.5f, y-1.7f}, {x+4.5f, y+1.7f}
+  };
+  addMesh(w, MESH_BARREL_REAR, rear, 6, barrel);
+
+  const float front[6][2] = {
+    {m-4.5f, y+1.2f}, {m-4.5f, y-1.2f}, {m, y-0.7f},
+    {m-4.5f, y+1.2f}, {m, y-0.7f}, {m, y+0.7f}
+  };
+  addMesh(w, MESH_BARREL_FRONT, front, 6, barrel);
+
+  // trapezoid resting on the bottom edge, 2 units narrower at the base
+  for (int j=0; j<2; j++)
+  {
+    float x1 = r.basket_x1[j], x2 = r.basket_x2[j];
+    const float basket[6][2] = {
+      {x1+2, -40}, {x2-2, -40}, {x2, -36.5},
+      {x2, -36.5}, {x1, -36.5}, {x1+2, -40}
+    };
+    addMesh(w, MESH_BASKET0 + j, basket, 6, colours[r.basket_c[j]]);
+  }
+
+  // bricks sit at the origin and are placed with the model matrix
+  const float brick[6][2] = {
+    {0, 0}, {r.brick_w, 0}, {r.brick_w, r.brick_h},
+    {r.brick_w, r.brick_h}, {0, r.brick_h}, {0, 0}
+  };
+  for (int c=0; c<3; c++)
+    addMesh(w, MESH_BRICK0 + c, brick, 6, colours[c]);
+}
+
+/* One directive of the text format. Returns false on a malformed line */
+static bool parseLine (const char* line, level_rules& r, vector<float>& mirrors)
+{
+  char word[16];
+  int n;
+  if (sscanf(line, " %15s%n", word, &n) != 1 || word[0] == '#')
+    return true;
+  line += n;
+
+  int j, c;
+  float a, b, d, e;
+  if (!strcmp(word, "bricks"))
+    return sscanf(line, "%d", &r.bricks) == 1 && r.bricks > 0;
+  if (!strcmp(word, "spawn"))
+    return sscanf(line, "%d %d %f %d", &r.spawn_x, &r.spawn_width, &r.spawn_y, &r.spawn_gap) == 4
+           && r.spawn_width > 0 && r.spawn_gap > 0;
+  if (!strcmp(word, "brick"))
+    return sscanf(line, "%f %f", &r.brick_w, &r.brick_h) == 2;
+  if (!strcmp(word, "cannon"))
+    return sscanf(line, "%f %f %f", &r.cannon_x, &r.cannon_mouth, &r.cannon_y) == 3;
+  if (!strcmp(word, "basket"))
+  {
+    if (sscanf(line, "%d %d %f %f", &j, &c, &a, &b) != 4 || j < 0 || j > 1 || c < 0 || c > 2)
+      return false;
+    r.basket_c[j] = c;
+    r.basket_x1[j] = a;
+    r.basket_x2[j] = b;
+    return true;
+  }
+  if (!strcmp(word, "mirror"))
+  {
+    if (sscanf(line, "%f %f %f %f", &a, &b, &d, &e) != 4)
+      return false;
+    mirrors.push_back(a);
+    mirrors.push_back(b);
+    mirrors.push_back(d);
+    mirrors.push_back(e);
+    return true;
+  }
+  return false;
+}
+
+bool compileLevel (const char* src_path, const char* out_path)
+{
+  FILE* in = fopen(src_path, "r");
+  if (!in)
+  {
+    fprintf(stderr, "level: cannot open %s\n", src_path);
+    return false;
+  }
+
+  level_rules r = classic_rules;
+  vector<float> mirrors;
+  char line[256];
+  int number = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), in))
+  {
+    number++;
+    if (!parseLine(line, r, mirrors))
+    {
+      fprintf(stderr, "%s:%d: bad line: %s", src_path, number, line);
+      ok = false;
+    }
+  }
+  fclose(in);
+  if (!ok)
+    return false;
+
+  level_writer w;
+  w.buf.resize(sizeof(level_file));
+  level_file* h = w.header();
+  memset(h, 0, sizeof(level_file));
+  h->magic = LEVEL_MAGIC;
+  h->version = LEVEL_VERSION;
+  h->rules = r;
+  h->num_mirrors = mirrors.size() / 4;
+  uint32_t mirror_offset = mirrors.empty() ? sizeof(level_file) : w.append(&mirrors[0], mirrors.size());
+  w.header()->mirror_offset = mirror_offset;
+  buildMeshes(w, r);
+  w.header()->size = w.buf.size();
+
+  // write beside the target and rename, so a running game never maps a half written level
+  string tmp = string(out_path) + ".tmp";
+  FILE* out = fopen(tmp.c_str(), "wb");
+  if (!out)
+  {
+    fprintf(stderr, "level: cannot write %s\n", tmp.c_str());
+    return false;
+  }
+  ok = fwrite(&w.buf[0], 1, w.buf.size(), out) == w.buf.size();
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), out_path) != 0)
+  {
+    fprintf(stderr, "level: cannot write %s\n", out_path);
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+static bool inside (const level_file* l, uint32_t offset, uint64_t bytes)
+{
+  return offset % 4 == 0 && offset >= sizeof(level_file) && offset + bytes <= l->size;
+}
+
+static const char* levelError (const level_file* l, size_t size)
+{
+  if (size < sizeof(level_file) || l->magic != LEVEL_MAGIC)
+    return "not a level file";
+  if (l->version != LEVEL_VERSION)
+    return "compiled for another version, rebuild it with levelc";
+  if (l->size != size)
+    return "truncated";
+  if (!inside(l, l->mirror_offset, 16ull * l->num_mirrors))
+    return "mirror table out of range";
+  for (int i=0; i<LEVEL_MESHES; i++)
+    if (!inside(l, l->mesh[i].vertex_offset, 12ull * l->mesh[i].vertices) ||
+        !inside(l, l->mesh[i].color_offset, 12ull * l->mesh[i].vertices))
+      return "mesh out of range";
+
+  const level_rules& r = l->rules;
+  if (r.bricks <= 0 || r.spawn_width <= 0 || r.spawn_gap <= 0)
+    return "bad spawn rules";
+  for (int j=0; j<2; j++)
+    if (r.basket_c[j] < 0 || r.basket_c[j] > 2)
+      return "bad basket colour";
+  return NULL;
+}
+
+const level_file* mapLevel (const char* path)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1)
+  {
+    fprintf(stderr, "level: cannot open %s\n", path);
+    return NULL;
+  }
+
+  struct stat st;
+  void* p = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    fprintf(stderr, "level: cannot map %s\n", path);
+    return NULL;
+  }
+
+  const level_file* l = (const level_file*)p;
+  const char* error = levelError(l, st.st_size);
+  if (error)
+  {
+    fprintf(stderr, "level: %s: %s\n", path, error);
+    munmap(p, st.st_size);
+    return NULL;
+  }
+  return l;
+}
+
+void unmapLevel (const level_file* l)
+{
+  if (l)
+    munmap((void*)l, l->size);
+}
@@ -0,0 +1,84 @@
+#ifndef LEVEL_H
+#define LEVEL_H
+
+#include <stdint.h>
+
+/* Binary level files.
+ *
+ * A level is written as text (see levels/classic.txt) and compiled with
+ * levelc into a single blob that is mmap'ed and used in place: a fixed
+ * header, then the mirror segments and the vertex/colour arrays of every
+ * mesh. The arrays are laid out exactly as glBufferData wants them (3
+ * floats per vertex, GL_TRIANGLES), so loading a level is a mapping and a
+ * few bounds checks, with nothing to parse. */
+
+#define LEVEL_MAGIC 0x564c4242  // "BBLV"
+#define LEVEL_VERSION 1
+
+/* Meshes every level provides, in the mesh table order */
+enum {
+  MESH_CANNON_OUTER,
+  MESH_CANNON_INNER,
+  MESH_BARREL_REAR,
+  MESH_BARREL_FRONT,
+  MESH_BASKET0,
+  MESH_BASKET1,
+  MESH_BRICK0,  // one per brick colour: black, red, green
+  MESH_BRICK1,
+  MESH_BRICK2,
+  LEVEL_MESHES
+};
+
+/* Everything about a level the simulation needs, apart from the mirrors */
+struct level_rules {
+  int32_t bricks;        // bricks in play
+  int32_t spawn_x;       // bricks drop in at a whole x in [spawn_x, spawn_x + spawn_width)
+  int32_t spawn_width;
+  int32_t spawn_gap;     // up to this many units of fall between queued bricks
+  float spawn_y;         // bottom edge of a new brick
+  float brick_w;
+  float brick_h;
+  float cannon_x;        // pivot of the barrel
+  float cannon_mouth;    // x of the barrel's end when level
+  float cannon_y;
+  float basket_x1[2];
+  float basket_x2[2];
+  int32_t basket_c[2];
+};
+
+/* Byte offsets from the start of the file, 4 byte aligned */
+struct level_mesh {
+  uint32_t vertices;
+  uint32_t vertex_offset;
+  uint32_t color_offset;
+};
+
+struct level_file {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t size;          // of the whole file
+  level_rules rules;
+  uint32_t num_mirrors;
+  uint32_t mirror_offset; // x1, y1, x2, y2 per mirror
+  level_mesh mesh[LEVEL_MESHES];
+};
+
+/* The level the game shipped with, played when no level file is given */
+#define CLASSIC_MIRRORS 3
+extern const level_rules classic_rules;
+extern const float classic_mirrors[CLASSIC_MIRRORS][4];
+
+/* Compiles a text level into a binary one. Errors go to stderr */
+bool compileLevel (const char* src_path, const char* out_path);
+
+/* Maps a compiled level read-only. Returns NULL (and says why on stderr)
+ * if the file is missing, truncated or from another version */
+const level_file* mapLevel (const char* path);
+void unmapLevel (const level_file* l);
+
+inline const float* levelFloats (const level_file* l, uint32_t offset)
+{
+  return (const float*)((const char*)l + offset);
+}
+
+#endif
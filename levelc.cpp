@@ -0,0 +1,25 @@
+/* Level compiler: turns a text level into the binary the game maps, or a
+ * text spawn pattern into the record file the game streams.
+ *
+ *   ./levelc levels/classic.txt classic.lvl
+ *   ./levelc --pattern patterns/waves.txt waves.bbp
+ *
+ * See levels/classic.txt and patterns/waves.txt for the directives. */
+
+#include <cstdio>
+#include <cstring>
+
+#include "level.h"
+#include "pattern.h"
+
+int main (int argc, char** argv)
+{
+  if (argc == 4 && strcmp(argv[1], "--pattern") == 0)
+    return compilePattern(argv[2], argv[3]) ? 0 : 1;
+  if (argc != 3)
+  {
+    fprintf(stderr, "usage: %s source.txt level.lvl\n       %s --pattern source.txt pattern.bbp\n", argv[0], argv[0]);
+    return 1;
+  }
+  return compileLevel(argv[1], argv[2]) ? 0 : 1;
+}
@@ -0,0 +1,361 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "netplay.h"
+#include "trace.h"
+
+using namespace std;
+
+/* Inputs are kept by tick % NET_RING; the window in use is never longer
+ * than NET_MAX_ROLLBACK + NET_MAX_DELAY ticks */
+#define NET_RING 128
+#define NET_MAGIC 0xB0   // | sender's player number
+#define NET_HAS_SYNC 1
+#define NET_HEADER 11
+#define NET_PACKET_MAX (NET_HEADER + 2*NET_RING + 12)
+#define NET_SYNC_TICKS TICK_RATE
+#define NET_SYNC_SLOTS 8
+
+bool net_active = false;
+net_stats net;
+int net_drop = 0;
+
+static int sock = -1;
+static sockaddr_storage peer_addr;
+static socklen_t peer_len = 0;
+static int me = 0;
+static int delay = NET_INPUT_DELAY;
+
+static uint16_t local_keys[NET_RING];
+static uint16_t remote_keys[NET_RING];
+static long remote_tick[NET_RING];  // tick each remote slot holds
+static uint16_t guessed[NET_RING];  // peer keys each played tick was played with
+static long local_latest;  // last tick this player's keys are queued for
+static long confirmed;     // peer keys known for every tick up to this
+static long peer_ack;      // the peer has this player's keys up to this
+static long replay_from;   // earliest tick played with a wrong guess, or -1
+
+/* Hashes of ticks whose inputs were final, ours and the latest from the peer */
+static long sync_tick[NET_SYNC_SLOTS];
+static uint64_t sync_hash[NET_SYNC_SLOTS];
+static long sync_out = -1;
+static long peer_sync_tick = -1;
+static uint64_t peer_sync_hash;
+
+static unsigned int drop_state = 1;
+
+void applyInput (int player, uint16_t keys)
+{
+  float d = 0;
+  if (keys & INPUT_BASKET_RIGHT)
+    d = 0.5;
+  else if (keys & INPUT_BASKET_LEFT)
+    d = -0.5;
+  bucket[player].translate += d;
+  bucket[player].x1 += d;
+  bucket[player].x2 += d;
+
+  d = 0;
+  if (keys & INPUT_CANNON_UP)
+    d = 0.5;
+  else if (keys & INPUT_CANNON_DOWN)
+    d = -0.5;
+  for (int j=0;j<2;j++)
+  {
+    gun[j].translate += d;
+    gun[j].y += d;
+  }
+
+  if (keys & INPUT_AIM_UP)
+    aimCannon(gun[0].rotate + 0.01);
+  else if (keys & INPUT_AIM_DOWN)
+    aimCannon(gun[0].rotate - 0.01);
+
+  float s = speed;
+  if (keys & INPUT_FASTER)
+    s = s + 0.1 > 0.5 ? 0.5 : s + 0.1;
+  if (keys & INPUT_SLOWER)
+    s = s - 0.1 < 0.1 ? 0.1 : s - 0.1;
+  setSpeed(s);
+
+  if (keys & INPUT_FIRE)
+    pullTrigger();
+}
+
+static void put32 (uint8_t* p, uint32_t v)
+{
+  for (int k=0;k<4;k++)
+    p[k] = v >> (8*k);
+}
+
+static uint32_t get32 (const uint8_t* p)
+{
+  return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* Our keys from the first the peer lacks, our ack of theirs, and a hash if one is due */
+static void sendInputs ()
+{
+  uint8_t buf[NET_PACKET_MAX];
+  long first = peer_ack + 1;
+  int count = local_latest - peer_ack;
+  buf[0] = NET_MAGIC | me;
+  buf[1] = sync_out >= 0 ? NET_HAS_SYNC : 0;
+  put32(buf + 2, first);
+  put32(buf + 6, confirmed);
+  buf[10] = count;
+  int size = NET_HEADER;
+  for (long t = first; t <= local_latest; t++)
+  {
+    buf[size++] = local_keys[t % NET_RING];
+    buf[size++] = local_keys[t % NET_RING] >> 8;
+  }
+  if (sync_out >= 0)
+  {
+    uint64_t h = sync_hash[(sync_out / NET_SYNC_TICKS) % NET_SYNC_SLOTS];
+    put32(buf + size, sync_out);
+    put32(buf + size + 4, h);
+    put32(buf + size + 8, h >> 32);
+    size += 12;
+    sync_out = -1;
+  }
+
+  if (net_drop > 0)
+  {
+    drop_state ^= drop_state << 13;
+    drop_state ^= drop_state >> 17;
+    drop_state ^= drop_state << 5;
+    if ((int)(drop_state % 100) < net_drop)
+    {
+      net.packets_dropped++;
+      return;
+    }
+  }
+  if (sendto(sock, buf, size, 0, (sockaddr*)&peer_addr, peer_len) == size)
+  {
+    net.packets_sent++;
+    net.bytes_sent += size;
+  }
+}
+
+static void checkSync ()
+{
+  int k = (peer_sync_tick / NET_SYNC_TICKS) % NET_SYNC_SLOTS;
+  if (peer_sync_tick < 0 || sync_tick[k] != peer_sync_tick)
+    return;
+  net.sync_checks++;
+  if (sync_hash[k] != peer_sync_hash)
+  {
+    if (net.desyncs++ == 0)
+      fprintf(stderr, "netplay: desync at tick %ld (%016llx here, %016llx on the peer)\n", peer_sync_tick,
+              (unsigned long long)sync_hash[k], (unsigned long long)peer_sync_hash);
+  }
+  peer_sync_tick = -1;
+}
+
+static void receive (const uint8_t* buf, int size)
+{
+  if (size < NET_HEADER || buf[0] != (NET_MAGIC | (1 - me)))
+    return;
+  long first = get32(buf + 2);
+  long ack = get32(buf + 6);
+  int count = buf[10];
+  if (size < NET_HEADER + 2*count + (buf[1] & NET_HAS_SYNC ? 12 : 0))
+    return;
+  net.packets_received++;
+
+  if (ack > peer_ack && ack <= local_latest)
+    peer_ack = ack;
+  for (int k=0;k<count;k++)
+  {
+    long t = first + k;
+    if (t <= confirmed || t >= confirmed + NET_RING || remote_tick[t % NET_RING] == t)
+      continue;
+    uint16_t keys = buf[NET_HEADER + 2*k] | buf[NET_HEADER + 2*k + 1] << 8;
+    remote_keys[t % NET_RING] = keys;
+    remote_tick[t % NET_RING] = t;
+    // already played on a guess: from here on the game was wrong
+    if (t < tick && guessed[t % NET_RING] != keys && (replay_from < 0 || t < replay_from))
+      replay_from = t;
+  }
+  while (remote_tick[(confirmed + 1) % NET_RING] == confirmed + 1)
+    confirmed++;
+
+  if (buf[1] & NET_HAS_SYNC)
+  {
+    const uint8_t* p = buf + NET_HEADER + 2*count;
+    peer_sync_tick = get32(p);
+    peer_sync_hash = get32(p + 4) | (uint64_t)get32(p + 8) << 32;
+    checkSync();
+  }
+}
+
+/* Plays the current tick with our queued keys and the peer's, real or guessed */
+static void play ()
+{
+  long t = tick;
+  int slot = t % NET_RING;
+  uint16_t theirs = remote_tick[slot] == t ? remote_keys[slot] : remote_keys[confirmed % NET_RING];
+  guessed[slot] = theirs;
+  snapshotTick();
+  applyInput(0, me == 0 ? local_keys[slot] : theirs);
+  applyInput(1, me == 1 ? local_keys[slot] : theirs);
+  stepGame();
+
+  // both inputs were real, so this state is final and can be compared
+  if (t <= confirmed && t % NET_SYNC_TICKS == 0)
+  {
+    int k = (t / NET_SYNC_TICKS) % NET_SYNC_SLOTS;
+    sync_tick[k] = t;
+    sync_hash[k] = stateHash();
+    sync_out = t;
+    checkSync();
+  }
+}
+
+void netPoll ()
+{
+  uint8_t buf[NET_PACKET_MAX];
+  int size;
+  while ((size = recv(sock, buf, sizeof(buf), 0)) >= 0)
+    receive(buf, size);
+
+  if (replay_from < 0)
+    return;
+  TRACE_SCOPE("rollback");
+  long now = tick;
+  if (rollbackTo(replay_from))
+  {
+    net.rollbacks++;
+    for (; tick < now && !gameover; net.replayed++)
+      play();
+  }
+  else
+    fprintf(stderr, "netplay: tick %ld is too old to roll back to\n", replay_from);
+  replay_from = -1;
+}
+
+bool netTick (uint16_t keys)
+{
+  netPoll();
+  if (gameover || tick - confirmed > NET_MAX_ROLLBACK || tick + delay - peer_ack >= NET_RING)
+  {
+    if (!gameover)
+      net.stalls++;
+    sendInputs();
+    return false;
+  }
+  local_latest = tick + delay;
+  local_keys[local_latest % NET_RING] = keys;
+  sendInputs();
+  play();
+  return true;
+}
+
+void netWait (int timeout_ms)
+{
+  pollfd p = { sock, POLLIN, 0 };
+  poll(&p, 1, timeout_ms);
+}
+
+bool netSettled ()
+{
+  return confirmed >= tick - 1 && replay_from < 0;
+}
+
+bool netSettle (int timeout_ms)
+{
+  for (int waited = 0; waited < timeout_ms; waited++)
+  {
+    netPoll();
+    // the game ends at this tick on both sides; later keys do not matter
+    if (netSettled() && peer_ack >= tick - 1)
+    {
+      // tell the peer we have all of its keys too; a few times, as nothing acks this
+      for (int k=0;k<3;k++)
+        sendInputs();
+      return true;
+    }
+    sendInputs();
+    netWait(1);
+  }
+  return false;
+}
+
+bool netStart (int player, int port, const char* peer, int input_delay)
+{
+  string host = peer;
+  size_t colon = host.rfind(':');
+  if (colon == string::npos)
+  {
+    fprintf(stderr, "netplay: peer must be host:port, not %s\n", peer);
+    return false;
+  }
+  string service = host.substr(colon + 1);
+  host.resize(colon);
+
+  addrinfo hints, *found = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host.c_str(), service.c_str(), &hints, &found) != 0 || found == NULL)
+  {
+    fprintf(stderr, "netplay: cannot resolve %s\n", peer);
+    return false;
+  }
+  memcpy(&peer_addr, found->ai_addr, found->ai_addrlen);
+  peer_len = found->ai_addrlen;
+  freeaddrinfo(found);
+
+  sockaddr_storage local;
+  memset(&local, 0, sizeof(local));
+  sockaddr_in* in = (sockaddr_in*)&local;
+  in->sin_family = AF_INET;
+  in->sin_port = htons(port);
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  if (sock < 0 || bind(sock, (sockaddr*)in, sizeof(*in)) != 0 || fcntl(sock, F_SETFL, O_NONBLOCK) != 0)
+  {
+    fprintf(stderr, "netplay: cannot bind UDP port %d\n", port);
+    if (sock >= 0)
+      close(sock);
+    sock = -1;
+    return false;
+  }
+
+  me = player;
+  delay = input_delay < 1 ? 1 : (input_delay > NET_MAX_DELAY ? NET_MAX_DELAY : input_delay);
+  memset(&net, 0, sizeof(net));
+  // the first delay ticks have no keys on either side
+  for (int k=0;k<NET_RING;k++)
+  {
+    local_keys[k] = remote_keys[k] = guessed[k] = 0;
+    remote_tick[k] = -1;
+  }
+  for (long t = tick; t < tick + delay; t++)
+    remote_tick[t % NET_RING] = t;
+  local_latest = confirmed = peer_ack = tick + delay - 1;
+  replay_from = -1;
+  for (int k=0;k<NET_SYNC_SLOTS;k++)
+    sync_tick[k] = -1;
+  sync_out = peer_sync_tick = -1;
+  drop_state = 2463534242u + player;
+  net_active = true;
+  return true;
+}
+
+void netStop ()
+{
+  if (sock >= 0)
+    close(sock);
+  sock = -1;
+  net_active = false;
+}
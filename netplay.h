@@ -0,0 +1,88 @@
+#ifndef NETPLAY_H
+#define NETPLAY_H
+
+#include <stdint.h>
+
+#include "game.h"
+
+/* Two-player lockstep over UDP.
+ *
+ * Both games start from the same seed, level and pattern and only exchange
+ * inputs: one 16 bit key mask per player per tick. Keys pressed on tick t are
+ * played on tick t + delay on both machines, and every packet carries all of
+ * this player's masks the peer has not acked yet, so a lost packet costs
+ * nothing but the next one being two bytes longer. In steady play a packet is
+ * an 11 byte header and a few masks, one packet per tick.
+ *
+ * When the peer's mask for a tick has not arrived yet its last known one is
+ * assumed. If the real one turns out different, the game is rolled back to
+ * that tick (rollbackTo) and the ticks since are played again. A player never
+ * gets more than NET_MAX_ROLLBACK ticks ahead of the peer's inputs; past that
+ * it stalls until they arrive.
+ *
+ * Player k moves basket k. The game has a single cannon (gun[0] is its base,
+ * gun[1] its barrel), which both players can move, aim and fire; player 0's
+ * keys are applied first. Once a second each side sends the stateHash() of a
+ * tick whose inputs are final, and a mismatch is reported as a desync. */
+
+#define NET_INPUT_DELAY 3
+#define NET_MAX_DELAY 16
+#define NET_MAX_ROLLBACK (SNAPSHOT_RING - NET_MAX_DELAY)
+
+/* Key mask bits, one tick of what the keyboard does */
+#define INPUT_BASKET_LEFT  0x001
+#define INPUT_BASKET_RIGHT 0x002
+#define INPUT_CANNON_UP    0x004
+#define INPUT_CANNON_DOWN  0x008
+#define INPUT_AIM_UP       0x010
+#define INPUT_AIM_DOWN     0x020
+#define INPUT_FIRE         0x040
+#define INPUT_FASTER       0x080
+#define INPUT_SLOWER       0x100
+
+struct net_stats {
+  long rollbacks;
+  long replayed;      // ticks played again after rollbacks
+  long stalls;        // ticks held back waiting for the peer
+  long packets_sent;
+  long packets_received;
+  long packets_dropped;  // by net_drop
+  long bytes_sent;
+  long sync_checks;
+  long desyncs;
+};
+
+extern bool net_active;
+extern net_stats net;
+/* Percent of outgoing packets thrown away, to test loss */
+extern int net_drop;
+
+/* Moves player's basket, and the cannon, as keys would for one tick */
+void applyInput (int player, uint16_t keys);
+
+/* Starts a session on the game initGame() just set up: binds UDP port and
+ * talks to peer, "host:port". False, with a message, if the socket cannot be
+ * set up */
+bool netStart (int player, int port, const char* peer, int delay = NET_INPUT_DELAY);
+void netStop ();
+
+/* Reads the peer's packets and rolls back if a guess was wrong, then plays
+ * one tick with keys as this player's input. False when the tick has to
+ * wait for the peer, or the game is over; the keys are dropped then */
+bool netTick (uint16_t keys);
+
+/* Reads the peer's packets and rolls back if needed, without playing */
+void netPoll ();
+
+/* Sleeps until a packet arrives or timeout_ms passes */
+void netWait (int timeout_ms);
+
+/* Every tick played so far used the peer's real inputs */
+bool netSettled ();
+
+/* Waits up to timeout_ms for the game to settle and the peer to ack this
+ * player's inputs up to the current tick, resending as it goes. Call before
+ * netStop() */
+bool netSettle (int timeout_ms);
+
+#endif
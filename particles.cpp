@@ -0,0 +1,122 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "arena.h"
+#include "particles.h"
+#include "trace.h"
+
+bool particlesInit (particle_pool* p, int capacity)
+{
+  memset(p, 0, sizeof(*p));
+  // one block: five float arrays, then the colours
+  char* block = (char*)heapAlloc((size_t)capacity * (5*sizeof(float) + 1));
+  if (block == NULL)
+    return false;
+  float* f = (float*)block;
+  p->x = f;
+  p->y = f + capacity;
+  p->vx = f + 2*capacity;
+  p->vy = f + 3*capacity;
+  p->life = f + 4*capacity;
+  p->c = (uint8_t*)(f + 5*capacity);
+  p->capacity = capacity;
+  p->rng = 2463534242u;
+  return true;
+}
+
+void particlesFree (particle_pool* p)
+{
+  heapFree(p->x);
+  memset(p, 0, sizeof(*p));
+}
+
+/* Uniform in [0, 1) */
+static float random01 (particle_pool* p)
+{
+  uint32_t r = p->rng;
+  r ^= r << 13;
+  r ^= r >> 17;
+  r ^= r << 5;
+  p->rng = r;
+  return (r >> 8) * (1.0f / 16777216);
+}
+
+void emitDebris (particle_pool* p, const rect& brick, int n)
+{
+  int fit = p->capacity - p->count;
+  if (n <= 0)
+    return;
+  if (n > fit)
+  {
+    p->dropped += n - fit;
+    n = fit;
+  }
+  TRACE_INSTANT("debris", n);
+  float cx = (brick.x1 + brick.x2) / 2, cy = (brick.y1 + brick.y2) / 2;
+  float w = brick.x2 - brick.x1, h = brick.y2 - brick.y1;
+  for (int k = 0, i = p->count; k < n; k++, i++)
+  {
+    float fx = random01(p) - 0.5f, fy = random01(p) - 0.5f;
+    p->x[i] = cx + fx*w;
+    p->y[i] = cy + fy*h;
+    // away from the middle, and a kick upwards so it arcs before falling
+    p->vx[i] = fx * (0.3f + 0.4f*random01(p));
+    p->vy[i] = fy * 0.3f + 0.15f + 0.15f*random01(p);
+    p->life[i] = DEBRIS_LIFE * (0.5f + 0.5f*random01(p));
+    p->c[i] = brick.c;
+  }
+  p->count += n;
+  p->emitted += n;
+}
+
+void updateParticles (particle_pool* p, float t)
+{
+  int n = p->count;
+  if (n == 0 || t <= 0)
+    return;
+  TRACE_SCOPE("particles");
+  float* __restrict x = p->x;
+  float* __restrict y = p->y;
+  float* __restrict vx = p->vx;
+  float* __restrict vy = p->vy;
+  float* __restrict life = p->life;
+  uint8_t* __restrict c = p->c;
+
+  // under constant gravity this is exact for any t, so a fast forwarded
+  // frame of many ticks is still one pass
+  float fall = 0.5f * DEBRIS_GRAVITY * t * t, dv = DEBRIS_GRAVITY * t;
+  int dead = 0;
+  for (int i = 0; i < n; i++)
+  {
+    float py = y[i] + vy[i] * t - fall;
+    float left = life[i] - t;
+    left = py < DEBRIS_FLOOR ? 0 : left;
+    x[i] += vx[i] * t;
+    y[i] = py;
+    vy[i] -= dv;
+    life[i] = left;
+    dead += left <= 0;
+  }
+  if (dead == 0)
+    return;
+
+  // a few percent die per tick: fill each hole with the last particle rather
+  // than shifting everything down; the order of debris does not matter
+  for (int i = 0; dead > 0; )
+  {
+    if (life[i] > 0)
+    {
+      i++;
+      continue;
+    }
+    n--;
+    dead--;
+    x[i] = x[n];
+    y[i] = y[n];
+    vx[i] = vx[n];
+    vy[i] = vy[n];
+    life[i] = life[n];
+    c[i] = c[n];
+  }
+  p->count = n;
+}
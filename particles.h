@@ -0,0 +1,49 @@
+#ifndef PARTICLES_H
+#define PARTICLES_H
+
+#include <stdint.h>
+
+#include "game.h"
+
+/* Debris thrown off bricks the laser destroys. Presentation only: nothing
+ * here feeds back into the game, and it is not in the saved state or the hash.
+ *
+ * Particles are a structure of arrays, one array per field, so an update is a
+ * few straight loops over contiguous floats that the compiler vectorizes, and
+ * the window hands the arrays to GL as they are. The pool is allocated once
+ * and never grows: a burst that does not fit is cut short and counted. */
+
+#define MAX_PARTICLES (128*1024)
+#define DEBRIS_PER_HIT 48
+/* Ticks a piece of debris lasts, at most; each gets between half and all of it */
+#define DEBRIS_LIFE 60
+/* Units per tick per tick */
+#define DEBRIS_GRAVITY 0.01f
+/* Debris that falls below the playfield is gone */
+#define DEBRIS_FLOOR -40.0f
+
+struct particle_pool {
+  int count;
+  int capacity;
+  float* x;
+  float* y;
+  float* vx;     // units per tick
+  float* vy;
+  float* life;   // ticks left
+  uint8_t* c;    // colour of the brick it came from
+  uint32_t rng;  // its own, so debris never touches the game's random numbers
+  long emitted;
+  long dropped;  // did not fit in capacity
+};
+
+/* False if the arrays cannot be allocated */
+bool particlesInit (particle_pool* p, int capacity = MAX_PARTICLES);
+void particlesFree (particle_pool* p);
+
+/* n pieces of brick, spread over it and flying outwards */
+void emitDebris (particle_pool* p, const rect& brick, int n);
+
+/* Moves everything on by ticks (any amount, fractions too) and drops the dead */
+void updateParticles (particle_pool* p, float ticks);
+
+#endif
@@ -0,0 +1,222 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "pattern.h"
+
+using namespace std;
+
+static bool earlier (const spawn_record& a, const spawn_record& b)
+{
+  return a.tick < b.tick;
+}
+
+/* "*" or a number; sets *random for "*" */
+static bool parseValue (const char* s, float* v, bool* random)
+{
+  char* end;
+  *random = strcmp(s, "*") == 0;
+  if (*random)
+    return true;
+  *v = strtof(s, &end);
+  return end != s && *end == '\0';
+}
+
+static bool record (vector<spawn_record>& out, long tick, const char* xs, float step, int k, const char* cs)
+{
+  spawn_record r;
+  float x, c;
+  bool rx, rc;
+  if (tick < 0 || !parseValue(xs, &x, &rx) || !parseValue(cs, &c, &rc) || (!rc && (c < 0 || c > 2)))
+    return false;
+  r.tick = tick;
+  r.x = rx ? 0 : x + k*step;
+  r.c = rc ? SPAWN_RANDOM_C : (uint8_t)c;
+  r.flags = rx ? SPAWN_RANDOM_X : 0;
+  r.pad = 0;
+  out.push_back(r);
+  return true;
+}
+
+/* One directive of the text format. Returns false on a malformed line */
+static bool parseLine (const char* line, vector<spawn_record>& out, uint32_t* loop)
+{
+  char word[16], xs[32], cs[32];
+  long tick, count, every;
+  float step;
+  int n;
+  if (sscanf(line, " %15s%n", word, &n) != 1 || word[0] == '#')
+    return true;
+  line += n;
+
+  if (!strcmp(word, "brick"))
+    return sscanf(line, "%ld %31s %31s", &tick, xs, cs) == 3 && record(out, tick, xs, 0, 0, cs);
+  if (!strcmp(word, "wave"))
+  {
+    if (sscanf(line, "%ld %ld %ld %31s %f %31s", &tick, &count, &every, xs, &step, cs) != 6 || count < 0 || every < 0)
+      return false;
+    for (long k=0; k<count; k++)
+      if (!record(out, tick + k*every, xs, step, k, cs))
+        return false;
+    return true;
+  }
+  if (!strcmp(word, "loop"))
+    return sscanf(line, "%u", loop) == 1;
+  return false;
+}
+
+bool compilePattern (const char* src_path, const char* out_path)
+{
+  FILE* in = fopen(src_path, "r");
+  if (!in)
+  {
+    fprintf(stderr, "pattern: cannot open %s\n", src_path);
+    return false;
+  }
+
+  vector<spawn_record> records;
+  pattern_header h = { PATTERN_MAGIC, PATTERN_VERSION, 0, 0 };
+  char line[256];
+  int number = 0;
+  bool ok = true;
+  while (fgets(line, sizeof(line), in))
+  {
+    number++;
+    if (!parseLine(line, records, &h.loop))
+    {
+      fprintf(stderr, "%s:%d: bad line: %s", src_path, number, line);
+      ok = false;
+    }
+  }
+  fclose(in);
+  if (!ok)
+    return false;
+
+  stable_sort(records.begin(), records.end(), earlier);
+  h.count = records.size();
+  if (h.loop > 0 && (h.count == 0 || records.back().tick >= h.loop))
+  {
+    fprintf(stderr, "%s: loop must be longer than the last spawn\n", src_path);
+    return false;
+  }
+
+  // write beside the target and rename, like compileLevel()
+  string tmp = string(out_path) + ".tmp";
+  FILE* out = fopen(tmp.c_str(), "wb");
+  if (!out)
+  {
+    fprintf(stderr, "pattern: cannot write %s\n", tmp.c_str());
+    return false;
+  }
+  ok = fwrite(&h, sizeof(h), 1, out) == 1;
+  if (h.count > 0)
+    ok = fwrite(&records[0], sizeof(spawn_record), h.count, out) == h.count && ok;
+  ok = fclose(out) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), out_path) != 0)
+  {
+    fprintf(stderr, "pattern: cannot write %s\n", out_path);
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool openPattern (spawn_pattern* p, const char* path)
+{
+  p->fd = open(path, O_RDONLY);
+  if (p->fd == -1)
+  {
+    fprintf(stderr, "pattern: cannot open %s\n", path);
+    return false;
+  }
+
+  pattern_header& h = p->header;
+  if (pread(p->fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != PATTERN_MAGIC || h.version != PATTERN_VERSION)
+  {
+    fprintf(stderr, "pattern: %s is not a pattern file, rebuild it with levelc --pattern\n", path);
+    closePattern(p);
+    return false;
+  }
+  posix_fadvise(p->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  rewindPattern(p);
+  return true;
+}
+
+void closePattern (spawn_pattern* p)
+{
+  if (p->fd != -1)
+    close(p->fd);
+  p->fd = -1;
+}
+
+void rewindPattern (spawn_pattern* p)
+{
+  p->base = 0;
+  p->read = 0;
+  p->pos = p->len = 0;
+}
+
+/* Decodes the next chunk, starting the next pass first if this one is done */
+static bool refill (spawn_pattern* p)
+{
+  if (p->read == p->header.count)
+  {
+    if (p->header.loop == 0 || p->header.count == 0)
+      return false;
+    p->base += p->header.loop;
+    p->read = 0;
+  }
+
+  uint32_t n = min<uint32_t>(PATTERN_CHUNK, p->header.count - p->read);
+  off_t at = sizeof(pattern_header) + (off_t)p->read * sizeof(spawn_record);
+  ssize_t got = pread(p->fd, p->chunk, n * sizeof(spawn_record), at);
+  if (got <= 0)
+    return false;
+  p->pos = 0;
+  p->len = got / sizeof(spawn_record);
+  p->read += p->len;
+
+  // have the following chunk on its way while this one plays
+  posix_fadvise(p->fd, at + got, PATTERN_CHUNK * sizeof(spawn_record), POSIX_FADV_WILLNEED);
+  return p->len > 0;
+}
+
+const spawn_record* nextSpawn (spawn_pattern* p, long* due)
+{
+  if (p->pos == p->len && !refill(p))
+    return NULL;
+  *due = p->base + p->chunk[p->pos].tick;
+  return &p->chunk[p->pos];
+}
+
+void popSpawn (spawn_pattern* p)
+{
+  if (p->pos < p->len)
+    p->pos++;
+}
+
+uint32_t tellPattern (const spawn_pattern* p, long* base)
+{
+  *base = p->base;
+  return p->read - p->len + p->pos;
+}
+
+void seekPattern (spawn_pattern* p, long base, uint32_t index)
+{
+  uint32_t first = p->read - p->len;
+  if (base == p->base && index >= first && index <= p->read)
+  {
+    p->pos = index - first;
+    return;
+  }
+  // the next nextSpawn() reads from index on
+  p->base = base;
+  p->read = index;
+  p->pos = p->len = 0;
+}
@@ -0,0 +1,61 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+
+/* Authored spawn patterns.
+ *
+ * A pattern is written as text (see patterns/waves.txt) and compiled with
+ * `levelc --pattern` into a file of spawn records sorted by tick. Playback
+ * streams the file in fixed size chunks, reading the next chunk only when
+ * the current one is used up and asking the kernel to prefetch the one
+ * after, so a pattern of any length plays in a few kilobytes. */
+
+#define PATTERN_MAGIC 0x54504242  // "BBPT"
+#define PATTERN_VERSION 1
+#define PATTERN_CHUNK 256
+
+#define SPAWN_RANDOM_X 1   // flag: x anywhere in the level's spawn range
+#define SPAWN_RANDOM_C 3   // colour: any of the three
+
+struct spawn_record {
+  uint32_t tick;   // from the start of the pattern
+  float x;
+  uint8_t c;       // 0 black, 1 red, 2 green, SPAWN_RANDOM_C
+  uint8_t flags;
+  uint16_t pad;
+};
+
+struct pattern_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t count;  // records
+  uint32_t loop;   // ticks after which the pattern starts over, 0 to play it once
+};
+
+struct spawn_pattern {
+  int fd;
+  pattern_header header;
+  long base;        // tick the current pass started
+  uint32_t read;    // records read from the file in this pass
+  int pos, len;     // playhead within chunk
+  spawn_record chunk[PATTERN_CHUNK];
+};
+
+bool compilePattern (const char* src_path, const char* out_path);
+
+bool openPattern (spawn_pattern* p, const char* path);
+void closePattern (spawn_pattern* p);
+void rewindPattern (spawn_pattern* p);
+
+/* Next record and the game tick it is due at, or NULL once a pattern that
+ * does not loop has ended. popSpawn() moves past it */
+const spawn_record* nextSpawn (spawn_pattern* p, long* due);
+void popSpawn (spawn_pattern* p);
+
+/* Playhead as the pass start tick and the index of the next record, for
+ * snapshots. Seeking inside the loaded chunk does not touch the file */
+uint32_t tellPattern (const spawn_pattern* p, long* base);
+void seekPattern (spawn_pattern* p, long base, uint32_t index);
+
+#endif
@@ -0,0 +1,674 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "spectate.h"
+#include "trace.h"
+
+using namespace std;
+
+spectate_stats spectators;
+
+struct spectator {
+  int fd;
+  uint8_t* out;     // unsent bytes are out[head..tail)
+  size_t head, tail;
+  long acked;       // newest seq the client has, -1 for none
+  long sent;        // newest seq queued for it
+  uint8_t ack[4];   // partly received ack
+  int ack_len;
+};
+
+static int listener = -1;
+static char unix_path[108];
+static spectator clients[SPECTATE_MAX_CLIENTS];
+static int num_clients = 0;
+
+/* The last SPECTATE_HISTORY frames, by seq % SPECTATE_HISTORY */
+static spectate_frame* history[SPECTATE_HISTORY];
+static uint32_t next_seq = 0;
+
+/* This tick's messages, one per base frame clients asked for: slot
+ * SPECTATE_HISTORY is the keyframe */
+static uint8_t* encoded[SPECTATE_HISTORY+1];
+static size_t encoded_len[SPECTATE_HISTORY+1];
+static uint32_t encoded_seq[SPECTATE_HISTORY+1];
+
+static int16_t quantize (float v, float scale)
+{
+  float q = roundf(v * scale);
+  return q > 32767 ? 32767 : (q < -32767 ? -32767 : (int16_t)q);
+}
+
+static uint8_t* put16 (uint8_t* p, int v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* put32 (uint8_t* p, uint32_t v)
+{
+  for (int k=0;k<4;k++)
+    p[k] = v >> (8*k);
+  return p + 4;
+}
+
+static uint8_t* putVar (uint8_t* p, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = v | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+static uint32_t zigzag (int v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static bool sameBrick (const spectate_brick& a, const spectate_brick& b)
+{
+  return a.x == b.x && a.y == b.y && a.c == b.c;
+}
+
+static bool sameBeam (const spectate_frame* a, const spectate_frame* b)
+{
+  return a->beam_points == b->beam_points && memcmp(a->beam, b->beam, 4 * a->beam_points) == 0;
+}
+
+/* Quantized copy of what a viewer sees this tick */
+static void capture (spectate_frame* f)
+{
+  f->seq = next_seq;
+  f->tick = tick;
+  f->points = points;
+  f->lasers = hit_count;
+  f->gameover = gameover;
+  for (int j=0;j<2;j++)
+    f->basket_x[j] = quantize(bucket[j].x1, SPECTATE_SCALE);
+  f->cannon_y = quantize(gun[0].y, SPECTATE_SCALE);
+  f->aim = quantize(gun[0].rotate, 4096);
+  f->brick_w = quantize(rules.brick_w, SPECTATE_SCALE);
+  f->brick_h = quantize(rules.brick_h, SPECTATE_SCALE);
+
+  // the beam's segments join up: the start of the first, then every end
+  f->beam_points = 0;
+  if (beams > 0)
+  {
+    f->beam[0] = quantize(bullet[0].x1, SPECTATE_SCALE);
+    f->beam[1] = quantize(bullet[0].y1, SPECTATE_SCALE);
+    for (int i=0;i<beams;i++)
+    {
+      f->beam[2*i+2] = quantize(bullet[i].x2, SPECTATE_SCALE);
+      f->beam[2*i+3] = quantize(bullet[i].y2, SPECTATE_SCALE);
+    }
+    f->beam_points = beams + 1;
+  }
+
+  f->num_bricks = num_boxes;
+  for (int i=0;i<num_boxes;i++)
+  {
+    spectate_brick& b = f->bricks[i];
+    if (boxes[i].alive)
+    {
+      b.x = quantize(boxes[i].x1, SPECTATE_SCALE);
+      b.y = quantize(boxes[i].y1, SPECTATE_SCALE);
+      b.c = boxes[i].c;
+    }
+    else
+    {
+      b.x = b.y = 0;
+      b.c = SPECTATE_GONE;
+    }
+  }
+}
+
+/* f as a message, whole or against base; returns its length */
+static size_t encode (uint8_t* out, const spectate_frame* f, const spectate_frame* base)
+{
+  uint8_t* p = out + 4;
+  *p++ = base ? 'D' : 'K';
+  p = put32(p, f->seq);
+  if (base)
+    p = put32(p, base->seq);
+  p = put32(p, f->tick);
+  p = put32(p, f->points);
+  p = put32(p, f->lasers);
+  *p++ = f->gameover;
+  p = put16(p, f->basket_x[0]);
+  p = put16(p, f->basket_x[1]);
+  p = put16(p, f->cannon_y);
+  p = put16(p, f->aim);
+  if (!base)
+  {
+    p = put16(p, f->brick_w);
+    p = put16(p, f->brick_h);
+  }
+
+  p = put16(p, f->num_bricks);
+  if (!base)
+  {
+    for (int i=0;i<f->num_bricks;i++)
+    {
+      p = put16(p, f->bricks[i].x);
+      p = put16(p, f->bricks[i].y);
+      *p++ = f->bricks[i].c;
+    }
+  }
+  else
+  {
+    static const spectate_brick gone = { 0, 0, SPECTATE_GONE };
+    uint8_t* count = p;
+    p += 2;
+    int changed = 0, next = 0;
+    for (int i=0;i<f->num_bricks;i++)
+    {
+      const spectate_brick& a = f->bricks[i];
+      const spectate_brick& b = i < base->num_bricks ? base->bricks[i] : gone;
+      if (sameBrick(a, b))
+        continue;
+      bool moved = a.x != b.x || a.c != b.c;
+      p = putVar(p, i - next);
+      p = putVar(p, zigzag(a.y - b.y) << 1 | moved);
+      if (moved)
+      {
+        p = putVar(p, zigzag(a.x - b.x));
+        *p++ = a.c;
+      }
+      next = i + 1;
+      changed++;
+    }
+    put16(count, changed);
+  }
+
+  if (base && sameBeam(f, base))
+    *p++ = 0xff;
+  else
+  {
+    *p++ = f->beam_points;
+    for (int k=0;k<2*f->beam_points;k++)
+      p = put16(p, f->beam[k]);
+  }
+
+  put32(out, p - out - 4);
+  return p - out;
+}
+
+static void dropClient (int k)
+{
+  close(clients[k].fd);
+  heapFree(clients[k].out);
+  clients[k] = clients[--num_clients];
+}
+
+static bool nonBlocking (int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+static void acceptClients ()
+{
+  int fd;
+  while ((fd = accept(listener, NULL, NULL)) >= 0)
+  {
+    uint8_t* out = num_clients < SPECTATE_MAX_CLIENTS ? (uint8_t*)heapAlloc(SPECTATE_BUFFER) : NULL;
+    if (out == NULL || !nonBlocking(fd))
+    {
+      heapFree(out);
+      close(fd);
+      continue;
+    }
+    spectator& s = clients[num_clients++];
+    s.fd = fd;
+    s.out = out;
+    s.head = s.tail = 0;
+    s.acked = s.sent = -1;
+    s.ack_len = 0;
+    spectators.accepted++;
+  }
+}
+
+/* Takes in whatever acks arrived; false once the client has gone */
+static bool readAcks (spectator& s)
+{
+  uint8_t buf[256];
+  while (true)
+  {
+    ssize_t n = recv(s.fd, buf, sizeof(buf), 0);
+    if (n == 0)
+      return false;
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    for (ssize_t k=0;k<n;k++)
+    {
+      s.ack[s.ack_len++] = buf[k];
+      if (s.ack_len == 4)
+      {
+        long seq = s.ack[0] | s.ack[1] << 8 | s.ack[2] << 16 | (uint32_t)s.ack[3] << 24;
+        if (seq > s.acked && seq < (long)next_seq)
+          s.acked = seq;
+        s.ack_len = 0;
+      }
+    }
+  }
+}
+
+static bool inHistory (long seq, const spectate_frame* f)
+{
+  return seq >= 0 && f->seq - seq < SPECTATE_HISTORY && history[seq % SPECTATE_HISTORY]->seq == seq;
+}
+
+/* The message for client s, built once per tick for each base frame. The
+ * base is the last frame it acked; if that has left the ring, the last one
+ * queued for it, which the ordered stream delivers before this message;
+ * failing both, a keyframe */
+static int messageFor (const spectator& s, const spectate_frame* f)
+{
+  int slot = SPECTATE_HISTORY;
+  const spectate_frame* base = NULL;
+  long seq = inHistory(s.acked, f) ? s.acked : (inHistory(s.sent, f) ? s.sent : -1);
+  if (seq >= 0)
+  {
+    slot = seq % SPECTATE_HISTORY;
+    base = history[slot];
+  }
+  if (encoded[slot] == NULL)
+    encoded[slot] = (uint8_t*)heapAlloc(SPECTATE_MESSAGE_MAX);
+  if (encoded_seq[slot] != f->seq || encoded_len[slot] == 0)
+  {
+    encoded_len[slot] = encode(encoded[slot], f, base);
+    encoded_seq[slot] = f->seq;
+    spectators.encodes++;
+  }
+  if (base == NULL)
+    spectators.keyframes++;
+  return slot;
+}
+
+/* Sends what the socket takes; false on an error other than a full socket */
+static bool flush (spectator& s)
+{
+  while (s.head < s.tail)
+  {
+    ssize_t n = send(s.fd, s.out + s.head, s.tail - s.head, MSG_NOSIGNAL);
+    if (n < 0)
+      return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    s.head += n;
+    spectators.bytes += n;
+  }
+  s.head = s.tail = 0;
+  return true;
+}
+
+void spectateTick ()
+{
+  if (listener < 0)
+    return;
+  TRACE_SCOPE("spectate");
+  acceptClients();
+
+  spectate_frame* f = history[next_seq % SPECTATE_HISTORY];
+  capture(f);
+  next_seq++;
+
+  for (int k=0;k<num_clients;)
+  {
+    spectator& s = clients[k];
+    if (!readAcks(s))
+    {
+      spectators.closed++;
+      dropClient(k);
+      continue;
+    }
+
+    int slot = messageFor(s, f);
+    size_t len = encoded_len[slot];
+    if (s.head > 0)
+    {
+      memmove(s.out, s.out + s.head, s.tail - s.head);
+      s.tail -= s.head;
+      s.head = 0;
+    }
+    // a client this far behind would only fall further: let it go
+    if (s.tail + len > SPECTATE_BUFFER)
+    {
+      spectators.dropped++;
+      dropClient(k);
+      continue;
+    }
+    memcpy(s.out + s.tail, encoded[slot], len);
+    s.tail += len;
+    s.sent = f->seq;
+    spectators.messages++;
+    if (!flush(s))
+    {
+      spectators.closed++;
+      dropClient(k);
+      continue;
+    }
+    k++;
+  }
+  spectators.clients = num_clients;
+  TRACE_COUNTER("spectators", num_clients);
+}
+
+/* A socket for addr: Unix if it has a / in it, else TCP on localhost */
+static int openSocket (const char* addr, sockaddr_storage* sa, socklen_t* len)
+{
+  memset(sa, 0, sizeof(*sa));
+  if (strchr(addr, '/') != NULL)
+  {
+    sockaddr_un* un = (sockaddr_un*)sa;
+    if (strlen(addr) >= sizeof(un->sun_path))
+      return -1;
+    un->sun_family = AF_UNIX;
+    strcpy(un->sun_path, addr);
+    *len = sizeof(*un);
+    return socket(AF_UNIX, SOCK_STREAM, 0);
+  }
+  sockaddr_in* in = (sockaddr_in*)sa;
+  in->sin_family = AF_INET;
+  in->sin_port = htons(atoi(addr));
+  in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  *len = sizeof(*in);
+  return socket(AF_INET, SOCK_STREAM, 0);
+}
+
+bool spectateStart (const char* addr)
+{
+  sockaddr_storage sa;
+  socklen_t len;
+  listener = openSocket(addr, &sa, &len);
+  if (listener >= 0 && sa.ss_family == AF_UNIX)
+  {
+    // a socket file left over from an earlier run
+    unlink(addr);
+    strcpy(unix_path, addr);
+  }
+  else
+  {
+    int on = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  }
+  if (listener < 0 || bind(listener, (sockaddr*)&sa, len) != 0 || listen(listener, 128) != 0 || !nonBlocking(listener))
+  {
+    fprintf(stderr, "spectate: cannot listen on %s\n", addr);
+    if (listener >= 0)
+      close(listener);
+    listener = -1;
+    return false;
+  }
+
+  for (int k=0;k<SPECTATE_HISTORY;k++)
+  {
+    history[k] = (spectate_frame*)heapAlloc(sizeof(spectate_frame));
+    history[k]->seq = ~0u;
+  }
+  memset(&spectators, 0, sizeof(spectators));
+  return true;
+}
+
+void spectateStop ()
+{
+  if (listener < 0)
+    return;
+  while (num_clients > 0)
+    dropClient(num_clients - 1);
+  close(listener);
+  listener = -1;
+  if (unix_path[0] != '\0')
+    unlink(unix_path);
+  unix_path[0] = '\0';
+  for (int k=0;k<=SPECTATE_HISTORY;k++)
+  {
+    if (k < SPECTATE_HISTORY)
+    {
+      heapFree(history[k]);
+      history[k] = NULL;
+    }
+    heapFree(encoded[k]);
+    encoded[k] = NULL;
+    encoded_len[k] = 0;
+  }
+}
+
+bool spectateConnect (spectate_client* c, const char* addr)
+{
+  memset(c, 0, sizeof(*c));
+  sockaddr_storage sa;
+  socklen_t len;
+  c->fd = openSocket(addr, &sa, &len);
+  if (c->fd < 0 || connect(c->fd, (sockaddr*)&sa, len) != 0 || !nonBlocking(c->fd))
+  {
+    if (c->fd >= 0)
+      close(c->fd);
+    c->fd = -1;
+    return false;
+  }
+  c->in = (uint8_t*)heapAlloc(2 * SPECTATE_MESSAGE_MAX);
+  for (int k=0;k<SPECTATE_HISTORY;k++)
+  {
+    c->frames[k] = (spectate_frame*)heapAlloc(sizeof(spectate_frame));
+    c->frames[k]->seq = ~0u;
+  }
+  c->latest = -1;
+  return true;
+}
+
+void spectateDisconnect (spectate_client* c)
+{
+  if (c->fd >= 0)
+    close(c->fd);
+  c->fd = -1;
+  heapFree(c->in);
+  c->in = NULL;
+  for (int k=0;k<SPECTATE_HISTORY;k++)
+  {
+    heapFree(c->frames[k]);
+    c->frames[k] = NULL;
+  }
+}
+
+/* Reader over one message that fails softly: running off the end sets bad */
+struct reader {
+  const uint8_t* p;
+  const uint8_t* end;
+  bool bad;
+};
+
+static uint32_t get8 (reader& r)
+{
+  if (r.p + 1 > r.end)
+  {
+    r.bad = true;
+    return 0;
+  }
+  return *r.p++;
+}
+
+static int16_t get16 (reader& r)
+{
+  uint32_t lo = get8(r);
+  return (int16_t)(lo | get8(r) << 8);
+}
+
+static uint32_t get32 (reader& r)
+{
+  uint32_t v = 0;
+  for (int k=0;k<4;k++)
+    v |= get8(r) << (8*k);
+  return v;
+}
+
+static uint32_t getVar (reader& r)
+{
+  uint32_t v = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    uint32_t b = get8(r);
+    v |= (b & 0x7f) << shift;
+    if (!(b & 0x80))
+      break;
+  }
+  return v;
+}
+
+static int unzigzag (uint32_t v)
+{
+  return (int)(v >> 1) ^ -(int)(v & 1);
+}
+
+static bool decode (spectate_client* c, const uint8_t* msg, size_t len)
+{
+  reader r = { msg, msg + len, false };
+  uint32_t kind = get8(r);
+  uint32_t seq = get32(r);
+  const spectate_frame* base = NULL;
+  if (kind == 'D')
+  {
+    uint32_t b = get32(r);
+    base = c->frames[b % SPECTATE_HISTORY];
+    if (base->seq != b)
+      return false;
+  }
+  else if (kind != 'K')
+    return false;
+
+  spectate_frame* f = c->frames[seq % SPECTATE_HISTORY];
+  if (f == base)
+    return false;
+  f->seq = seq;
+  f->tick = get32(r);
+  f->points = get32(r);
+  f->lasers = get32(r);
+  f->gameover = get8(r);
+  f->basket_x[0] = get16(r);
+  f->basket_x[1] = get16(r);
+  f->cannon_y = get16(r);
+  f->aim = get16(r);
+  if (base)
+  {
+    f->brick_w = base->brick_w;
+    f->brick_h = base->brick_h;
+  }
+  else
+  {
+    f->brick_w = get16(r);
+    f->brick_h = get16(r);
+  }
+
+  f->num_bricks = (uint16_t)get16(r);
+  if (f->num_bricks > MAX_BOXES)
+    return false;
+  if (!base)
+  {
+    for (int i=0;i<f->num_bricks;i++)
+    {
+      f->bricks[i].x = get16(r);
+      f->bricks[i].y = get16(r);
+      f->bricks[i].c = get8(r);
+    }
+  }
+  else
+  {
+    static const spectate_brick gone = { 0, 0, SPECTATE_GONE };
+    for (int i=0;i<f->num_bricks;i++)
+      f->bricks[i] = i < base->num_bricks ? base->bricks[i] : gone;
+    int changed = (uint16_t)get16(r), i = 0;
+    for (int k=0;k<changed && !r.bad;k++)
+    {
+      i += getVar(r);
+      if (i >= f->num_bricks)
+        return false;
+      uint32_t v = getVar(r);
+      f->bricks[i].y += unzigzag(v >> 1);
+      if (v & 1)
+      {
+        f->bricks[i].x += unzigzag(getVar(r));
+        f->bricks[i].c = get8(r);
+      }
+      i++;
+    }
+  }
+
+  uint32_t n = get8(r);
+  if (n == 0xff && base)
+  {
+    f->beam_points = base->beam_points;
+    memcpy(f->beam, base->beam, sizeof(f->beam));
+  }
+  else
+  {
+    if (n > MAX_BEAMS + 1)
+      return false;
+    f->beam_points = n;
+    for (uint32_t k=0;k<2*n;k++)
+      f->beam[k] = get16(r);
+  }
+  if (r.bad)
+    return false;
+
+  if ((long)seq > c->latest)
+    c->latest = seq;
+  // the server may delta the next frames against this one
+  uint8_t ack[4] = { (uint8_t)seq, (uint8_t)(seq >> 8), (uint8_t)(seq >> 16), (uint8_t)(seq >> 24) };
+  send(c->fd, ack, 4, MSG_NOSIGNAL);
+  return true;
+}
+
+int spectateRead (spectate_client* c)
+{
+  int frames = 0;
+  while (true)
+  {
+    ssize_t n = recv(c->fd, c->in + c->in_len, 2 * SPECTATE_MESSAGE_MAX - c->in_len, 0);
+    if (n == 0)
+      return -1;
+    if (n < 0)
+    {
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        return -1;
+      break;
+    }
+    c->in_len += n;
+    c->bytes += n;
+
+    size_t used = 0;
+    while (c->in_len - used >= 4)
+    {
+      const uint8_t* m = c->in + used;
+      size_t len = m[0] | m[1] << 8 | m[2] << 16 | (uint32_t)m[3] << 24;
+      if (len > SPECTATE_MESSAGE_MAX)
+        return -1;
+      if (c->in_len - used < 4 + len)
+        break;
+      if (!decode(c, m + 4, len))
+        return -1;
+      used += 4 + len;
+      c->messages++;
+      frames++;
+    }
+    memmove(c->in, c->in + used, c->in_len - used);
+    c->in_len -= used;
+  }
+  return frames;
+}
+
+const spectate_frame* spectateLatest (const spectate_client* c)
+{
+  return c->latest < 0 ? NULL : c->frames[c->latest % SPECTATE_HISTORY];
+}
@@ -0,0 +1,112 @@
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include <stdint.h>
+
+#include "game.h"
+
+/* Spectator server: streams the game to local viewers over a Unix socket
+ * (an address with a / in it) or TCP on localhost (a port number).
+ *
+ * Every tick the state a viewer can see (bricks, the beam polyline, the
+ * baskets, the cannon and the score) is quantized into a spectate_frame and
+ * kept in a ring of SPECTATE_HISTORY. Each client is sent that frame as a
+ * delta against the last frame it acked. A client whose acks fall out of
+ * the ring gets a delta against the last frame sent to it, which the ordered
+ * stream delivers first, and a new client a whole frame (a keyframe).
+ * Clients with the same base share one encoded message, so hundreds of
+ * viewers cost little more than a few.
+ *
+ * Nothing blocks the game: sockets are non-blocking, each client's unsent
+ * bytes are capped at SPECTATE_BUFFER, and a client that falls that far
+ * behind is disconnected.
+ *
+ * Wire format, little endian. Server to client, one message per tick:
+ *   u32 length of the rest
+ *   u8 'K' (keyframe) or 'D' (delta), u32 seq, u32 base seq (deltas only),
+ *   u32 tick, i32 points, i32 lasers used, u8 flags (1 game over),
+ *   i16 basket x[2], i16 cannon y, i16 aim,
+ *   keyframes: i16 brick width, i16 brick height,
+ *   u16 bricks, then
+ *     keyframes: per brick i16 x, i16 y, u8 colour
+ *     deltas: u16 changed, per changed brick varint index gap (from the
+ *       one after the last changed), varint zigzag(dy) << 1 | moved, and if
+ *       moved varint zigzag(dx) and u8 colour; bricks past the base's count
+ *       are compared with a gone brick at 0,0
+ *   u8 beam points (0xff: same as the base), then per point i16 x, i16 y.
+ * Positions are in 1/SPECTATE_SCALE units, the aim in 1/4096 radians, and a
+ * brick that is not in play has colour SPECTATE_GONE. Client to server: u32
+ * seq of each frame it has decoded. */
+
+#define SPECTATE_SCALE 64
+#define SPECTATE_GONE 0xff
+#define SPECTATE_HISTORY 16
+#define SPECTATE_MAX_CLIENTS 512
+#define SPECTATE_BUFFER (128*1024)
+#define SPECTATE_MESSAGE_MAX (64*1024)
+
+struct spectate_brick {
+  int16_t x;  // bottom left corner
+  int16_t y;
+  uint8_t c;
+};
+
+struct spectate_frame {
+  uint32_t seq;
+  uint32_t tick;
+  int32_t points;
+  int32_t lasers;
+  uint8_t gameover;
+  int16_t basket_x[2];
+  int16_t cannon_y;
+  int16_t aim;
+  int16_t brick_w;
+  int16_t brick_h;
+  uint8_t beam_points;
+  int16_t beam[2*(MAX_BEAMS+1)];
+  uint16_t num_bricks;
+  spectate_brick bricks[MAX_BOXES];  // only num_bricks are used
+};
+
+struct spectate_stats {
+  long clients;
+  long accepted;
+  long dropped;      // fell SPECTATE_BUFFER behind
+  long closed;       // went away
+  long keyframes;
+  long messages;
+  long encodes;      // messages built; the rest were shared
+  long bytes;
+};
+
+extern spectate_stats spectators;
+
+/* Listens on addr; false, with a message, if it cannot */
+bool spectateStart (const char* addr);
+void spectateStop ();
+
+/* Publishes the current tick: takes new clients and acks, sends the frame */
+void spectateTick ();
+
+/* Viewer side: frames are decoded into a ring like the server's */
+struct spectate_client {
+  int fd;
+  uint8_t* in;
+  size_t in_len;
+  spectate_frame* frames[SPECTATE_HISTORY];
+  long latest;  // seq of the newest frame, -1 before the first
+  long messages;
+  long bytes;
+};
+
+bool spectateConnect (spectate_client* c, const char* addr);
+void spectateDisconnect (spectate_client* c);
+
+/* Decodes and acks what has arrived; the number of frames, or -1 once the
+ * server has gone or sent something that does not decode */
+int spectateRead (spectate_client* c);
+
+/* Newest frame, NULL before the first */
+const spectate_frame* spectateLatest (const spectate_client* c);
+
+#endif
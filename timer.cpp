@@ -0,0 +1,179 @@
+#include "timer.h"
+
+static void wheelReady (timer_wheel* w, int idx)
+{
+  w->timers[idx].next = -1;
+  if (w->ready == -1)
+    w->ready = idx;
+  else
+    w->timers[w->ready_tail].next = idx;
+  w->ready_tail = idx;
+}
+
+/* Files timer idx under the level whose slot width matches its distance from now */
+static void wheelPlace (timer_wheel* w, int idx)
+{
+  timer* t = &w->timers[idx];
+  long delta = t->due - w->now;
+  if (delta <= 0)
+  {
+    wheelReady(w, idx);
+    return;
+  }
+
+  int level = 0;
+  while (level < WHEEL_LEVELS-1 && delta >= (1L << (WHEEL_BITS*(level+1))))
+    level++;
+  int s = (t->due >> (WHEEL_BITS*level)) & (WHEEL_SLOTS-1);
+  t->next = w->slot[level][s];
+  w->slot[level][s] = idx;
+  w->occupied[level] |= 1ull << s;
+}
+
+void wheelInit (timer_wheel* w, long now)
+{
+  w->now = now;
+  for (int l=0; l<WHEEL_LEVELS; l++)
+  {
+    for (int s=0; s<WHEEL_SLOTS; s++)
+      w->slot[l][s] = -1;
+    w->occupied[l] = 0;
+  }
+  w->ready = w->ready_tail = -1;
+  w->armed = 0;
+  w->free_list = -1;
+  w->fresh = 0;
+}
+
+/* Arms a timer for tick due. A due tick not in the future fires on the next pop */
+bool wheelAdd (timer_wheel* w, long due, int kind, int arg)
+{
+  int idx = w->free_list;
+  if (idx != -1)
+    w->free_list = w->timers[idx].next;
+  else if (w->fresh < MAX_TIMERS)
+    idx = w->fresh++;
+  else
+    return false;
+  w->armed++;
+
+  timer* t = &w->timers[idx];
+  t->due = due;
+  t->kind = kind;
+  t->arg = arg;
+  wheelPlace(w, idx);
+  return true;
+}
+
+/* Moves one slot's timers down the wheel now that the finer levels have wrapped */
+static void wheelCascade (timer_wheel* w, int level)
+{
+  int s = (w->now >> (WHEEL_BITS*level)) & (WHEEL_SLOTS-1);
+  int idx = w->slot[level][s];
+  w->slot[level][s] = -1;
+  w->occupied[level] &= ~(1ull << s);
+  while (idx != -1)
+  {
+    int next = w->timers[idx].next;
+    wheelPlace(w, idx);
+    idx = next;
+  }
+}
+
+/* Steps the wheel to tick `to`; everything due by then can be popped */
+void wheelAdvance (timer_wheel* w, long to)
+{
+  while (w->now < to)
+  {
+    w->now++;
+
+    // coarser levels first, their timers may land in a finer slot due right now
+    int top = 0;
+    while (top < WHEEL_LEVELS-1 && (w->now & ((1L << (WHEEL_BITS*(top+1))) - 1)) == 0)
+      top++;
+    for (int l=top; l>0; l--)
+      wheelCascade(w, l);
+
+    int s = w->now & (WHEEL_SLOTS-1);
+    int idx = w->slot[0][s];
+    w->slot[0][s] = -1;
+    w->occupied[0] &= ~(1ull << s);
+    while (idx != -1)
+    {
+      int next = w->timers[idx].next;
+      wheelReady(w, idx);
+      idx = next;
+    }
+  }
+}
+
+bool wheelPop (timer_wheel* w, int* kind, int* arg)
+{
+  int idx = w->ready;
+  if (idx == -1)
+    return false;
+  w->ready = w->timers[idx].next;
+  if (w->ready == -1)
+    w->ready_tail = -1;
+
+  *kind = w->timers[idx].kind;
+  *arg = w->timers[idx].arg;
+  w->timers[idx].next = w->free_list;
+  w->free_list = idx;
+  w->armed--;
+  return true;
+}
+
+/* Lists are numbered level*WHEEL_SLOTS + slot, and the ready list comes last */
+#define READY_LIST (WHEEL_LEVELS*WHEEL_SLOTS)
+
+static int saveList (const timer_wheel* w, int idx, int list, timer* out)
+{
+  int n = 0;
+  for (; idx != -1; idx = w->timers[idx].next)
+  {
+    out[n] = w->timers[idx];
+    out[n].next = list;
+    n++;
+  }
+  return n;
+}
+
+int wheelSave (const timer_wheel* w, timer* out)
+{
+  int n = 0;
+  for (int l=0; l<WHEEL_LEVELS; l++)
+    for (uint64_t bits = w->occupied[l]; bits; bits &= bits - 1)
+    {
+      int s = __builtin_ctzll(bits);
+      n += saveList(w, w->slot[l][s], l*WHEEL_SLOTS + s, out + n);
+    }
+  return n + saveList(w, w->ready, READY_LIST, out + n);
+}
+
+void wheelRestore (timer_wheel* w, long now, const timer* in, int n)
+{
+  wheelInit(w, now);
+  int prev = -1;
+  for (int i=0; i<n && i<MAX_TIMERS; i++)
+  {
+    int list = in[i].next;
+    w->timers[i] = in[i];
+    w->timers[i].next = -1;
+
+    // a list's timers were saved together, so each one follows the one before or starts its list
+    if (prev != -1 && in[prev].next == list)
+      w->timers[prev].next = i;
+    else if (list == READY_LIST)
+      w->ready = i;
+    else
+    {
+      w->slot[list / WHEEL_SLOTS][list % WHEEL_SLOTS] = i;
+      w->occupied[list / WHEEL_SLOTS] |= 1ull << (list % WHEEL_SLOTS);
+    }
+    if (list == READY_LIST)
+      w->ready_tail = i;
+    prev = i;
+  }
+  w->fresh = w->armed = n < MAX_TIMERS ? n : MAX_TIMERS;
+}
@@ -0,0 +1,51 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+/* Hierarchical timer wheel driven by the simulation tick.
+ *
+ * Level L has 64 slots of 64^L ticks each, so four levels cover 2^24 ticks
+ * (about three days at 60 Hz). Advancing one tick only touches the slot that
+ * comes due, plus a cascade of one higher level slot every 64 ticks, so the
+ * cost is proportional to the number of timers firing, not the number armed.
+ *
+ * The wheel is a plain struct of arrays with indices instead of pointers, so
+ * copying it copies every pending timer. */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define MAX_TIMERS 4160
+
+struct timer {
+  long due;
+  int kind;
+  int arg;
+  int next;
+};
+
+struct timer_wheel {
+  long now;
+  int slot[WHEEL_LEVELS][WHEEL_SLOTS];
+  uint64_t occupied[WHEEL_LEVELS];  // bit s set while slot s has timers
+  int ready;       // fired timers not yet popped
+  int ready_tail;
+  int free_list;   // released timers
+  int fresh;       // timers[fresh..] have never been used
+  int armed;
+  timer timers[MAX_TIMERS];
+};
+
+void wheelInit (timer_wheel* w, long now);
+bool wheelAdd (timer_wheel* w, long due, int kind, int arg);
+void wheelAdvance (timer_wheel* w, long to);
+bool wheelPop (timer_wheel* w, int* kind, int* arg);
+
+/* Copies the armed timers to out (room for w->armed) in an order wheelRestore
+ * rebuilds exactly, so timers due on the same tick still fire in the same
+ * order. Returns the number copied */
+int wheelSave (const timer_wheel* w, timer* out);
+void wheelRestore (timer_wheel* w, long now, const timer* in, int n);
+
+#endif
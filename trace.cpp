@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+struct trace_event {
+  const char* name;
+  uint64_t ts;     // nanoseconds since trace_start()
+  int64_t arg;
+  char ph;         // Chrome phase: B, E, i, C
+};
+
+/* Events are appended into fixed size chunks owned by one thread. A chunk is
+ * published with a release store of its count, so trace_write() can read the
+ * buffers while the game is still running. */
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_MAX_CHUNKS 256
+
+struct trace_chunk {
+  trace_event ev[TRACE_CHUNK_EVENTS];
+  atomic<int> count;
+  atomic<trace_chunk*> next;
+};
+
+struct trace_buffer {
+  trace_chunk* head;
+  trace_chunk* tail;
+  int chunks;
+  int tid;
+  const char* name;
+  atomic<uint64_t> dropped;
+};
+
+bool trace_enabled = false;
+
+static chrono::steady_clock::time_point trace_epoch;
+static mutex trace_registry_lock;
+static vector<trace_buffer*> trace_registry;
+static thread_local trace_buffer* trace_local = NULL;
+static thread_local bool trace_muted = false;
+
+static trace_chunk* trace_new_chunk ()
+{
+  trace_chunk* c = new trace_chunk;
+  c->count.store(0, memory_order_relaxed);
+  c->next.store(NULL, memory_order_relaxed);
+  return c;
+}
+
+/* Runs once per thread; the registry lock is never taken while recording */
+static trace_buffer* trace_register_thread ()
+{
+  trace_buffer* b = new trace_buffer;
+  b->head = b->tail = trace_new_chunk();
+  b->chunks = 1;
+  b->name = NULL;
+  b->dropped.store(0, memory_order_relaxed);
+
+  lock_guard<mutex> guard(trace_registry_lock);
+  b->tid = (int)trace_registry.size() + 1;
+  trace_registry.push_back(b);
+  return b;
+}
+
+static void trace_push (char ph, const char* name, int64_t arg)
+{
+  if (trace_muted)
+    return;
+  if (trace_local == NULL)
+    trace_local = trace_register_thread();
+  trace_buffer* b = trace_local;
+
+  trace_chunk* c = b->tail;
+  int n = c->count.load(memory_order_relaxed);
+  if (n == TRACE_CHUNK_EVENTS)
+  {
+    if (b->chunks == TRACE_MAX_CHUNKS)
+    {
+      b->dropped.fetch_add(1, memory_order_relaxed);
+      return;
+    }
+    trace_chunk* fresh = trace_new_chunk();
+    c->next.store(fresh, memory_order_release);
+    b->tail = c = fresh;
+    b->chunks++;
+    n = 0;
+  }
+
+  trace_event& e = c->ev[n];
+  e.name = name;
+  e.ts = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - trace_epoch).count();
+  e.arg = arg;
+  e.ph = ph;
+  c->count.store(n + 1, memory_order_release);
+}
+
+void trace_start ()
+{
+  trace_epoch = chrono::steady_clock::now();
+  trace_enabled = true;
+}
+
+void trace_thread_name (const char* name)
+{
+  if (trace_local == NULL)
+    trace_local = trace_register_thread();
+  trace_local->name = name;
+}
+
+void trace_mute (bool mute)
+{
+  trace_muted = mute;
+}
+
+void trace_begin (const char* name) { trace_push('B', name, 0); }
+void trace_end (const char* name) { trace_push('E', name, 0); }
+void trace_instant (const char* name, int64_t arg) { trace_push('i', name, arg); }
+void trace_counter (const char* name, int64_t value) { trace_push('C', name, value); }
+
+/* Names are literals chosen by us, but escape anyway so the JSON stays valid */
+static void trace_write_string (FILE* f, const char* s)
+{
+  fputc('"', f);
+  for (; *s; s++)
+  {
+    if (*s == '"' || *s == '\\')
+      fputc('\\', f);
+    fputc(*s, f);
+  }
+  fputc('"', f);
+}
+
+bool trace_write (const char* path)
+{
+  FILE* f = fopen(path, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "trace: cannot open %s\n", path);
+    return false;
+  }
+
+  lock_guard<mutex> guard(trace_registry_lock);
+  fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"brickbreaker\"}}");
+
+  uint64_t total = 0, dropped = 0;
+  for (size_t t = 0; t < trace_registry.size(); t++)
+  {
+    trace_buffer* b = trace_registry[t];
+    if (b->name != NULL)
+    {
+      fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", b->tid);
+      trace_write_string(f, b->name);
+      fprintf(f, "}}");
+    }
+
+    for (trace_chunk* c = b->head; c != NULL; c = c->next.load(memory_order_acquire))
+    {
+      int n = c->count.load(memory_order_acquire);
+      for (int i = 0; i < n; i++)
+      {
+        const trace_event& e = c->ev[i];
+        fprintf(f, ",\n{\"name\":");
+        trace_write_string(f, e.name);
+        fprintf(f, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d", e.ph, e.ts / 1000.0, b->tid);
+        if (e.ph == 'i')
+          fprintf(f, ",\"s\":\"t\",\"args\":{\"arg\":%lld}", (long long)e.arg);
+        else if (e.ph == 'C')
+          fprintf(f, ",\"args\":{\"value\":%lld}", (long long)e.arg);
+        fputc('}', f);
+      }
+      total += n;
+    }
+    dropped += b->dropped.load(memory_order_relaxed);
+  }
+
+  fprintf(f, "\n]}\n");
+  fclose(f);
+
+  printf("trace: wrote %llu events to %s", (unsigned long long)total, path);
+  if (dropped > 0)
+    printf(" (%llu dropped, buffer full)", (unsigned long long)dropped);
+  printf("\n");
+  return true;
+}
@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Timeline recorder that exports Chrome Trace Event JSON (chrome://tracing, Perfetto).
+ * Every thread appends into its own buffer, so recording never takes a lock.
+ * Event names must be string literals (only the pointer is stored). */
+
+extern bool trace_enabled;
+
+void trace_start ();
+bool trace_write (const char* path);
+void trace_thread_name (const char* name);
+/* Drops this thread's events, for threads that only play the game speculatively */
+void trace_mute (bool mute);
+
+void trace_begin (const char* name);
+void trace_end (const char* name);
+void trace_instant (const char* name, int64_t arg = 0);
+void trace_counter (const char* name, int64_t value);
+
+/* Emits a begin/end pair around the enclosing block */
+struct trace_scope {
+  const char* name;
+  trace_scope (const char* n) : name(n) { if (trace_enabled) trace_begin(name); }
+  ~trace_scope () { if (trace_enabled) trace_end(name); }
+};
+
+#define TRACE_CONCAT_(a,b) a##b
+#define TRACE_CONCAT(a,b) TRACE_CONCAT_(a,b)
+#define TRACE_SCOPE(name) trace_scope TRACE_CONCAT(trace_scope_,__LINE__) (name)
+#define TRACE_INSTANT(name, arg) do { if (trace_enabled) trace_instant(name, arg); } while (0)
+#define TRACE_COUNTER(name, value) do { if (trace_enabled) trace_counter(name, value); } while (0)
+
+#endif
@@ -0,0 +1,425 @@
+/* Scripted headless play session. Used as the training run of PGO builds,
+ * so the profile reflects an actual game rather than a single benchmark.
+ *
+ *   ./brickbreaker_train [--ticks N] [--seed S] [--bricks B] [--level file.lvl] [--pattern file.bbp]
+ *                        [--autopilot THREADS] [--record-hashes file | --verify-replay file]
+ *                        [--net PLAYER PORT HOST:PORT [--net-delay TICKS] [--net-drop PERCENT]]
+ *                        [--spectate ADDR] [--realtime]
+ *
+ * One tick is one frame of the windowed game at 60 Hz. --autopilot plays with
+ * the lookahead planner instead of the script (THREADS 0 is one per core) and
+ * reports how long it took per tick.
+ *
+ * --record-hashes writes stateHash() after every tick; --verify-replay plays
+ * the same session and stops at the first tick whose hash differs, so a build
+ * with other flags (-O3, -ffast-math, vectorized loops) can be checked against
+ * a stream recorded by the reference build. Both print the hash once a minute
+ * of play. The level and pattern files are not recorded: pass the same ones.
+ *
+ * --net plays one side of a two-player lockstep session (netplay.h) against
+ * another brickbreaker_train started with the other player number, both
+ * scripted. They run flat out, so packets arrive many ticks late and most
+ * ticks are guessed and rolled back, unless --realtime paces them. The
+ * session ends at --ticks or game over; both sides then print the same state
+ * hash if they stayed in sync. --net-drop throws away that share of the
+ * outgoing packets.
+ *
+ * --spectate streams the game to viewers (spectate.h, brickbreaker_watch) on
+ * a Unix socket path or localhost TCP port, and reports what it sent.
+ * --realtime runs 60 ticks a second like the game instead of flat out. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <thread>
+
+#include "arena.h"
+#include "game.h"
+#include "autopilot.h"
+#include "netplay.h"
+#include "spectate.h"
+
+using namespace std;
+
+#define HASH_LOG_TICKS (60 * TICK_RATE)
+
+/* Hash stream file: this header, then one 64 bit hash per tick */
+struct hash_header {
+  char magic[4];  // "BBHS"
+  unsigned int seed;
+  int bricks;
+  int autopilot;  // -1 for the script; thread counts play the same game
+  long ticks;
+};
+
+/* Moves basket j towards x by at most one keyboard step */
+static void follow (int j, float x)
+{
+  float centre = (bucket[j].x1 + bucket[j].x2) / 2;
+  float d = x - centre;
+  if (d > 0.5)
+    d = 0.5;
+  else if (d < -0.5)
+    d = -0.5;
+  bucket[j].x1 += d;
+  bucket[j].x2 += d;
+  bucket[j].translate += d;
+}
+
+/* x of the lowest falling brick of colour c still above the baskets */
+static bool lowest (int c, float* x)
+{
+  int best = -1;
+  for (int i = 0; i < num_boxes; i++)
+    if (boxes[i].alive && boxes[i].c == c && boxes[i].y2 > -36 && (best == -1 || boxes[i].y1 < boxes[best].y1))
+      best = i;
+  if (best == -1)
+    return false;
+  *x = (boxes[best].x1 + boxes[best].x2) / 2;
+  return true;
+}
+
+/* The scripted player's inputs for tick t */
+static void play (long t)
+{
+  // cannon sweeps up and down the left edge while rotating
+  float target = 20 * sin(t * 0.003);
+  float dy = target - gun[0].y;
+  gun[0].y += dy;
+  gun[1].y += dy;
+  gun[0].translate += dy;
+  gun[1].translate += dy;
+  aimCannon(0.6 * sin(t * 0.01));
+
+  float x;
+  for (int j = 0; j < 2; j++)
+    if (lowest(bucket[j].c, &x))
+      follow(j, x);
+
+  // trigger held down, the cooldown limits it to one shot per second
+  pullTrigger();
+}
+
+/* The scripted player's keys for a networked tick: each player keeps its
+ * basket under the next brick of its colour, player 0 sweeps the aim and
+ * player 1 the cannon height, and both hold the trigger */
+static uint16_t playKeys (int player, long t)
+{
+  uint16_t keys = INPUT_FIRE;
+  float x;
+  if (lowest(bucket[player].c, &x))
+  {
+    float centre = (bucket[player].x1 + bucket[player].x2) / 2;
+    if (x > centre + 0.5)
+      keys |= INPUT_BASKET_RIGHT;
+    else if (x < centre - 0.5)
+      keys |= INPUT_BASKET_LEFT;
+  }
+
+  if (player == 0)
+  {
+    float aim = 0.6 * sin(t * 0.01);
+    if (gun[0].rotate < aim - 0.01)
+      keys |= INPUT_AIM_UP;
+    else if (gun[0].rotate > aim + 0.01)
+      keys |= INPUT_AIM_DOWN;
+  }
+  else
+  {
+    float y = 20 * sin(t * 0.003);
+    if (gun[0].y < y - 0.5)
+      keys |= INPUT_CANNON_UP;
+    else if (gun[0].y > y + 0.5)
+      keys |= INPUT_CANNON_DOWN;
+  }
+  return keys;
+}
+
+/* Waits until tick t is due when running at the game's pace */
+static void pace (chrono::steady_clock::time_point start, long t)
+{
+  chrono::steady_clock::time_point due = start + chrono::microseconds(t * 1000000 / TICK_RATE);
+  if (net_active)
+    while (chrono::steady_clock::now() < due)
+      netWait(1);
+  else
+    this_thread::sleep_until(due);
+}
+
+static void printSpectators ()
+{
+  printf("spectate: %ld viewers (%ld dropped as too slow, %ld left), %ld messages of which %ld keyframes, %ld encoded, %.1f MB sent\n",
+         spectators.accepted, spectators.dropped, spectators.closed, spectators.messages, spectators.keyframes,
+         spectators.encodes, spectators.bytes / 1e6);
+}
+
+/* One side of a lockstep session; 0 if it finished in sync */
+static int playNet (long ticks, int player, bool realtime)
+{
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  while (tick < ticks && !(gameover && netSettled()))
+  {
+    if (realtime)
+      pace(start, tick);
+    if (netTick(playKeys(player, tick)))
+      spectateTick();
+    else
+      netWait(1);
+  }
+  bool settled = netSettle(2000);
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  printf("%ld ticks, %d points%s\n", tick, points, gameover ? ", game over" : "");
+  printf("netplay: hash %016llx%s\n", (unsigned long long)stateHash(), settled ? "" : " (peer did not answer at the end)");
+  printf("netplay: %ld rollbacks replaying %ld ticks, %ld stalls, %ld sync checks, %ld desyncs\n",
+         net.rollbacks, net.replayed, net.stalls, net.sync_checks, net.desyncs);
+  printf("netplay: %ld packets sent (%ld dropped), %ld received, %.1f bytes per tick, %.3f ms per tick\n",
+         net.packets_sent, net.packets_dropped, net.packets_received,
+         (double)net.bytes_sent / (tick > 0 ? tick : 1), elapsed * 1000 / (tick > 0 ? tick : 1));
+  netStop();
+  if (spectators.accepted > 0)
+    printSpectators();
+  spectateStop();
+  return settled && net.desyncs == 0 ? 0 : 1;
+}
+
+int main (int argc, char** argv)
+{
+  long ticks = 36000;
+  unsigned int seed = 1;
+  int bricks = 0;
+  const char* level_path = NULL;
+  const char* pattern_path = NULL;
+  int autopilot = -1;
+  const char* record_path = NULL;
+  const char* verify_path = NULL;
+  int net_player = -1, net_port = 0, net_delay = NET_INPUT_DELAY;
+  bool realtime = false;
+  const char* spectate_addr = NULL;
+  const char* net_peer = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--ticks") == 0 && i+1 < argc)
+      ticks = atol(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && i+1 < argc)
+      seed = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--bricks") == 0 && i+1 < argc)
+      bricks = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--level") == 0 && i+1 < argc)
+      level_path = argv[++i];
+    else if (strcmp(argv[i], "--pattern") == 0 && i+1 < argc)
+      pattern_path = argv[++i];
+    else if (strcmp(argv[i], "--autopilot") == 0 && i+1 < argc)
+      autopilot = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--record-hashes") == 0 && i+1 < argc)
+      record_path = argv[++i];
+    else if (strcmp(argv[i], "--verify-replay") == 0 && i+1 < argc)
+      verify_path = argv[++i];
+    else if (strcmp(argv[i], "--net") == 0 && i+3 < argc)
+    {
+      net_player = atoi(argv[++i]) ? 1 : 0;
+      net_port = atoi(argv[++i]);
+      net_peer = argv[++i];
+    }
+    else if (strcmp(argv[i], "--net-delay") == 0 && i+1 < argc)
+      net_delay = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--net-drop") == 0 && i+1 < argc)
+      net_drop = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--spectate") == 0 && i+1 < argc)
+      spectate_addr = argv[++i];
+    else if (strcmp(argv[i], "--realtime") == 0)
+      realtime = true;
+    else
+    {
+      fprintf(stderr, "usage: %s [--ticks N] [--seed S] [--bricks B] [--level file.lvl] [--pattern file.bbp] [--autopilot THREADS]"
+              " [--record-hashes file | --verify-replay file]"
+              " [--net PLAYER PORT HOST:PORT [--net-delay TICKS] [--net-drop PERCENT]]"
+              " [--spectate ADDR] [--realtime]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  if (level_path != NULL)
+  {
+    const level_file* l = mapLevel(level_path);
+    if (l == NULL)
+      return 1;
+    useLevel(l);
+  }
+  static spawn_pattern waves;
+  if (pattern_path != NULL)
+  {
+    if (!openPattern(&waves, pattern_path))
+      return 1;
+    usePattern(&waves);
+  }
+
+  hash_header header;
+  memcpy(header.magic, "BBHS", 4);
+  header.seed = seed;
+  header.bricks = bricks;
+  header.autopilot = autopilot < 0 ? -1 : 0;
+  header.ticks = ticks;
+
+  FILE* hashes = NULL;
+  long recorded = 0;
+  if (record_path != NULL)
+  {
+    hashes = fopen(record_path, "wb");
+    if (hashes == NULL || fwrite(&header, sizeof(header), 1, hashes) != 1)
+    {
+      perror(record_path);
+      return 1;
+    }
+  }
+  else if (verify_path != NULL)
+  {
+    hash_header want;
+    hashes = fopen(verify_path, "rb");
+    if (hashes == NULL)
+    {
+      perror(verify_path);
+      return 1;
+    }
+    if (fread(&want, sizeof(want), 1, hashes) != 1 || memcmp(want.magic, "BBHS", 4) != 0)
+    {
+      fprintf(stderr, "%s: not a hash stream\n", verify_path);
+      return 1;
+    }
+    if (want.seed != seed || want.bricks != bricks || want.autopilot != header.autopilot)
+    {
+      fprintf(stderr, "%s: recorded with --seed %u --bricks %d%s\n", verify_path, want.seed, want.bricks,
+              want.autopilot < 0 ? "" : " --autopilot");
+      return 1;
+    }
+    recorded = want.ticks;
+  }
+
+  game_messages = false;
+  initGame(seed, bricks);
+  if (spectate_addr != NULL && !spectateStart(spectate_addr))
+    return 1;
+  if (net_peer != NULL)
+  {
+    if (!netStart(net_player, net_port, net_peer, net_delay))
+      return 1;
+    return playNet(ticks, net_player, realtime);
+  }
+  if (autopilot >= 0)
+    autopilotStart(autopilot);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  heap_stats warm = heapStats();
+  int games = 1;
+  long total = 0;
+  long diverged = -1;
+  // tick where writing or reading the hash stream failed
+  long cut = -1;
+  for (long t = 0; t < ticks; t++)
+  {
+    // brick speed cycles through the range the N/M keys allow
+    setSpeed(0.1 + ((t / 600) % 5) * 0.1);
+
+    if (autopilot >= 0)
+      autopilotTick();
+    else
+      play(t);
+    stepGame();
+    spectateTick();
+    if (realtime)
+      pace(start, t + 1);
+
+    if (hashes != NULL)
+    {
+      uint64_t h = stateHash();
+      if (record_path != NULL)
+      {
+        // a full disk must not leave a short reference behind
+        if (fwrite(&h, sizeof(h), 1, hashes) != 1)
+        {
+          perror(record_path);
+          cut = t;
+          break;
+        }
+      }
+      else if (t < recorded)
+      {
+        uint64_t want;
+        // the header says how long the session was; less data is damage
+        if (fread(&want, sizeof(want), 1, hashes) != 1)
+        {
+          fprintf(stderr, "%s: hash stream truncated at tick %ld of %ld\n", verify_path, t, recorded);
+          cut = t;
+          break;
+        }
+        else if (want != h)
+        {
+          printf("replay diverges at tick %ld (game %d, tick %ld of it): expected %016llx, got %016llx\n",
+                 t, games, tick, (unsigned long long)want, (unsigned long long)h);
+          diverged = t;
+          break;
+        }
+      }
+      if ((t + 1) % HASH_LOG_TICKS == 0)
+        printf("tick %ld: hash %016llx\n", t + 1, (unsigned long long)h);
+    }
+
+    // buffers reach their working size within the first second of play
+    if (t == TICK_RATE)
+      warm = heapStats();
+
+    if (gameover)
+    {
+      total += points;
+      games++;
+      initGame(seed + games, bricks);
+    }
+  }
+  total += points;
+  if (diverged >= 0)
+    ticks = diverged + 1;
+  if (cut >= 0)
+    ticks = cut;
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  heap_stats heap = heapStats();
+  if (autopilot >= 0)
+    autopilotStop();
+
+  printf("%ld ticks, %d games, %ld points\n", ticks, games, total);
+  if (ticks > TICK_RATE)
+    printf("heap: %llu allocations after the first second, %llu live bytes then and %llu at the end\n",
+           (unsigned long long)(heap.allocs - warm.allocs), (unsigned long long)warm.live, (unsigned long long)heap.live);
+  if (autopilot >= 0)
+    printf("autopilot: %.3f ms per tick\n", elapsed * 1000 / (ticks > 0 ? ticks : 1));
+  if (pattern != NULL)
+    printf("brick store: %d slots, %ld spawns dropped\n", num_boxes, spawns_dropped);
+  if (spectate_addr != NULL)
+  {
+    printSpectators();
+    spectateStop();
+  }
+
+  if (record_path != NULL && (fclose(hashes) != 0 || cut >= 0))
+  {
+    if (cut < 0)
+      perror(record_path);
+    return 1;
+  }
+  if (verify_path != NULL)
+  {
+    fclose(hashes);
+    if (diverged >= 0 || cut >= 0)
+      return 1;
+    if (recorded < ticks)
+    {
+      printf("replay matches for the %ld recorded ticks of %ld\n", recorded, ticks);
+      return recorded > 0 ? 0 : 1;
+    }
+    printf("replay matches for all %ld ticks\n", ticks);
+  }
+  return 0;
+}
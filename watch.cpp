@@ -0,0 +1,107 @@
+/* Headless spectator for the game's --spectate stream, and a load test for it.
+ *
+ *   ./brickbreaker_watch ADDR [--clients N] [--seconds S] [--stall]
+ *
+ * ADDR is the Unix socket path or TCP port the game listens on. Prints the
+ * first viewer's picture of the game once a second, and how many bytes a
+ * viewer gets. --clients opens that many viewers from this process;
+ * --stall has them never read, so the server should drop them. */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+
+#include "spectate.h"
+
+using namespace std;
+
+int main (int argc, char** argv)
+{
+  const char* addr = NULL;
+  int count = 1;
+  double seconds = 10;
+  bool stall = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--clients") == 0 && i+1 < argc)
+      count = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc)
+      seconds = atof(argv[++i]);
+    else if (strcmp(argv[i], "--stall") == 0)
+      stall = true;
+    else if (addr == NULL && argv[i][0] != '-')
+      addr = argv[i];
+    else
+      addr = NULL, i = argc;
+  }
+  if (addr == NULL || count < 1)
+  {
+    fprintf(stderr, "usage: %s ADDR [--clients N] [--seconds S] [--stall]\n", argv[0]);
+    return 1;
+  }
+
+  spectate_client* viewers = (spectate_client*)calloc(count, sizeof(spectate_client));
+  for (int k = 0; k < count; k++)
+    if (!spectateConnect(&viewers[k], addr))
+    {
+      fprintf(stderr, "watch: cannot connect to %s\n", addr);
+      return 1;
+    }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now(), report = start;
+  int open = count;
+  long frames = 0;
+  while (open > 0 && chrono::steady_clock::now() - start < chrono::duration<double>(seconds))
+  {
+    this_thread::sleep_for(chrono::milliseconds(2));
+    if (stall)
+      continue;
+    for (int k = 0; k < count; k++)
+    {
+      if (viewers[k].fd < 0)
+        continue;
+      int n = spectateRead(&viewers[k]);
+      if (n < 0)
+      {
+        spectateDisconnect(&viewers[k]);
+        open--;
+      }
+      else if (k == 0)
+        frames += n;
+    }
+
+    const spectate_frame* f = viewers[0].fd >= 0 ? spectateLatest(&viewers[0]) : NULL;
+    if (f != NULL && chrono::steady_clock::now() - report >= chrono::seconds(1))
+    {
+      report = chrono::steady_clock::now();
+      int live = 0;
+      for (int i = 0; i < f->num_bricks; i++)
+        live += f->bricks[i].c != SPECTATE_GONE;
+      printf("tick %u: %d points, %d lasers used, %d bricks, beam of %d points%s\n", f->tick, f->points,
+             f->lasers, live, f->beam_points, f->gameover ? ", game over" : "");
+    }
+  }
+
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (stall)
+  {
+    // anything the server kept open is still readable; anything it dropped ends
+    open = 0;
+    for (int k = 0; k < count; k++)
+    {
+      while (spectateRead(&viewers[k]) > 0)
+        ;
+      open += spectateRead(&viewers[k]) >= 0;
+    }
+  }
+  printf("%d of %d viewers still connected after %.1f s\n", open, count, elapsed);
+  if (frames > 0)
+    printf("viewer 0: %ld frames, %.0f bytes per frame\n", frames, (double)viewers[0].bytes / frames);
+  for (int k = 0; k < count; k++)
+    if (viewers[k].fd >= 0)
+      spectateDisconnect(&viewers[k]);
+  free(viewers);
+  return 0;
+}